@@ -7,11 +7,17 @@
  * @date 3/24/2008
  */
  
+#include <algorithm>
+#include <climits>
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include "IndexSorter.h"
 
 using namespace std;
 
+int BTreeIndex::fillPercent = BTreeIndex::DEFAULT_FILL_PERCENT;
+int BTreeIndex::residentMemory = BTreeIndex::DEFAULT_RESIDENT_MEMORY;
+
 /*
  * BTreeIndex constructor
  */
@@ -19,6 +25,13 @@ BTreeIndex::BTreeIndex()
 {
 	treeHeight = 0;
   rootPid = -1;
+	nodeLayout = NODE_LAYOUT_COUNTED;
+	entryCount = 0;
+	minKey = 0;
+	maxKey = 0;
+	leafCount = 0;
+	residentLevels = 0;
+	residentStale = false;
 }
 
 /*
@@ -34,21 +47,46 @@ RC BTreeIndex::open(const string& indexname, char mode)
 	if((errorCode = pf.open(indexname, mode)) < 0)
 		return errorCode;
 	
-	//Set or retrieve treeHeight and rootPid from first page
+	//Set or retrieve treeHeight, rootPid and the node layout from first page
 	if(pf.endPid() <= 0){
-		//Tree has not been initialized yet
-		char buffer[PageFile::PAGE_SIZE];
-		memset(buffer, 0, PageFile::PAGE_SIZE);
-		memcpy(buffer, &treeHeight, sizeof(int));
-		memcpy(buffer + sizeof(int), &rootPid, sizeof(PageId));
-		if((errorCode = pf.write(0, buffer)) < 0)
+		//Tree has not been initialized yet, new trees keep the entry counts of the children
+		treeHeight = 0;
+		rootPid = -1;
+		nodeLayout = NODE_LAYOUT_COUNTED;
+		entryCount = minKey = maxKey = leafCount = 0;
+		if((errorCode = writeHeader()) < 0)
 			return errorCode;
 	}else{
-		char buffer[PageFile::PAGE_SIZE];
+		char buffer[PageFile::MAX_PAGE_SIZE];
 		if((errorCode = pf.read(0, buffer)) < 0)
 			return errorCode;
 		memcpy(&treeHeight, buffer, sizeof(int));
 		memcpy(&rootPid, buffer + sizeof(int), sizeof(PageId));
+		//Indexes written before the layout was recorded hold 0 here (NODE_LAYOUT_INTERLEAVED)
+		memcpy(&nodeLayout, buffer + sizeof(int) + sizeof(PageId), sizeof(int));
+		memcpy(&entryCount, buffer + 3*sizeof(int), sizeof(int));
+		memcpy(&minKey, buffer + 4*sizeof(int), sizeof(int));
+		memcpy(&maxKey, buffer + 5*sizeof(int), sizeof(int));
+		memcpy(&leafCount, buffer + 6*sizeof(int), sizeof(int));
+		if(!isNodeLayout(nodeLayout)){
+			pf.close();
+			return RC_INVALID_FILE_FORMAT;
+		}
+		//Upgrade an old index before it is modified. Read-only opens use it as it is
+		if(mode == 'w' && nodeLayout != NODE_LAYOUT_COUNTED){
+			if((errorCode = convert(NODE_LAYOUT_COUNTED)) < 0)
+				return errorCode;
+		}
+		//Older indexes have no statistics. Collect them once they can be stored
+		if(mode == 'w' && !hasStats()){
+			if((errorCode = computeStats()) < 0)
+				return errorCode;
+		}
+	}
+	//Keep the upper levels in memory until the index is closed
+	if((errorCode = loadResident()) < 0){
+		pf.close();
+		return errorCode;
 	}
   return 0;
 }
@@ -60,13 +98,293 @@ RC BTreeIndex::open(const string& indexname, char mode)
 RC BTreeIndex::close()
 {
 	RC errorCode;
-	char buffer[PageFile::PAGE_SIZE];
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	clearResident();
+	//Nothing changes in an index opened for reading
+	if(!pf.isReadOnly() && (errorCode = writeHeader()) < 0)
+		return errorCode;
+  return pf.close();
+}
+
+/*
+ * Store treeHeight, rootPid and the node layout in the first page.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::writeHeader()
+{
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	memset(buffer, 0, pf.pageSize());
 	memcpy(buffer, &treeHeight, sizeof(int));
 	memcpy(buffer + sizeof(int), &rootPid, sizeof(PageId));
-	if((errorCode = pf.write(0, buffer)) < 0)
+	memcpy(buffer + sizeof(int) + sizeof(PageId), &nodeLayout, sizeof(int));
+	memcpy(buffer + 3*sizeof(int), &entryCount, sizeof(int));
+	memcpy(buffer + 4*sizeof(int), &minKey, sizeof(int));
+	memcpy(buffer + 5*sizeof(int), &maxKey, sizeof(int));
+	memcpy(buffer + 6*sizeof(int), &leafCount, sizeof(int));
+	return pf.write(0, buffer);
+}
+
+/*
+ * Count the entries and leaves and find the smallest and largest key
+ * by reading the leaves from left to right.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::computeStats()
+{
+	RC errorCode;
+	PageId pid = rootPid;
+	entryCount = minKey = maxKey = leafCount = 0;
+	if(rootPid < 0 || treeHeight < 1)
+		return 0;
+	
+	//Follow the first pointers down to the leftmost leaf
+	BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+	for(int level = treeHeight; level > 1; level--){
+		if((errorCode = nonLeafNode.pin(pid, pf)) < 0)
+			return errorCode;
+		pid = nonLeafNode.getChildPtr(0);
+	}
+	nonLeafNode.unpin();
+	
+	BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+	while(pid != RC_END_OF_TREE){
+		int key;
+		RecordId rid;
+		if((errorCode = leafNode.pin(pid, pf)) < 0)
+			return errorCode;
+		//The keys are sorted, so the first and the last key bound the range
+		int n = leafNode.getKeyCount();
+		if(n > 0){
+			leafNode.readEntry(0, key, rid);
+			if(entryCount == 0)
+				minKey = key;
+			leafNode.readEntry(n-1, maxKey, rid);
+		}
+		entryCount += n;
+		leafCount++;
+		pid = leafNode.getNextNodePtr();
+	}
+	return 0;
+}
+
+/*
+ * Count a new entry in the statistics, widening the key range to include key.
+ */
+void BTreeIndex::noteKey(int key)
+{
+	if(entryCount == 0 || key < minKey)
+		minKey = key;
+	if(entryCount == 0 || key > maxKey)
+		maxKey = key;
+	entryCount++;
+}
+
+/*
+ * Keep the root and the levels below it in memory, a whole level at a time,
+ * as long as they fit in residentMemory. A level's size is known from the
+ * key counts of the level above, so no page is read that is not kept.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::loadResident()
+{
+	RC errorCode;
+	int size = pf.pageSize();
+	size_t maxNodes = residentMemory / size;
+	clearResident();
+	if(rootPid < 0 || treeHeight < 2)
+		return 0;
+	
+	vector<PageId> level(1, rootPid);
+	BTNonLeafNode nonLeafNode(size, nodeLayout);
+	for(int height = treeHeight; height > 1; height--){
+		if(residentSlots.size() + level.size() > maxNodes)
+			break;
+		vector<PageId> children;
+		for(size_t i = 0; i < level.size(); i++){
+			if((errorCode = nonLeafNode.read(level[i], pf)) < 0){
+				clearResident();
+				return errorCode;
+			}
+			residentSlots.push_back(make_pair(level[i], (int) residentSlots.size()));
+			residentPages.insert(residentPages.end(), nonLeafNode.getBufferPointer(), nonLeafNode.getBufferPointer() + size);
+			for(int j = 0; j <= nonLeafNode.getKeyCount(); j++)
+				children.push_back(nonLeafNode.getChildPtr(j));
+		}
+		level.swap(children);
+		residentLevels++;
+	}
+	sort(residentSlots.begin(), residentSlots.end());
+	return 0;
+}
+
+/*
+ * Drop the resident nodes.
+ */
+void BTreeIndex::clearResident()
+{
+	residentSlots.clear();
+	residentPages.clear();
+	residentLevels = 0;
+	residentStale = false;
+}
+
+/*
+ * Return the resident copy of the nonleaf node pid. NULL if it is not resident
+ */
+const char* BTreeIndex::residentNode(PageId pid) const
+{
+	vector<pair<PageId, int> >::const_iterator it;
+	it = lower_bound(residentSlots.begin(), residentSlots.end(), make_pair(pid, -1));
+	if(it == residentSlots.end() || it->first != pid)
+		return NULL;
+	return &residentPages[(size_t) it->second * pf.pageSize()];
+}
+
+/*
+ * Use the resident copy of the nonleaf node pid as the content of node,
+ * or pin its page if it is not resident.
+ */
+RC BTreeIndex::pinNonLeaf(BTNonLeafNode& node, PageId pid) const
+{
+	const char* resident = residentNode(pid);
+	if(resident == NULL)
+		return node.pin(pid, pf);
+	node.view(resident);
+	return 0;
+}
+
+/*
+ * Write the nonleaf node pid and update its resident copy. A resident node
+ * that gains or loses a child while its children are resident marks the
+ * resident levels stale; insert() loads them again once the tree is consistent.
+ */
+RC BTreeIndex::writeNonLeaf(BTNonLeafNode& node, PageId pid)
+{
+	RC errorCode;
+	if((errorCode = node.write(pid, pf)) < 0)
 		return errorCode;
-  return pf.close();
+	
+	char* resident = (char*) residentNode(pid);
+	if(resident == NULL)
+		return 0;
+	int keyCount;
+	memcpy(&keyCount, resident + pf.pageSize() - sizeof(int), sizeof(int));
+	if(keyCount != node.getKeyCount() && residentNode(node.getChildPtr(0)) != NULL)
+		residentStale = true;
+	memcpy(resident, node.getBufferPointer(), pf.pageSize());
+	return 0;
+}
+
+/*
+ * Rewrite every node of the index in another on-page layout.
+ * The index must be open in 'w' mode.
+ * @param layout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::convert(int layout)
+{
+	RC errorCode;
+	if(!isNodeLayout(layout))
+		return RC_INVALID_FILE_FORMAT;
+	if(layout == nodeLayout)
+		return 0;
+	//The resident nodes are copies in the old layout
+	clearResident();
+	//Counted nonleaf nodes hold fewer keys, so they cannot be converted one by one
+	if(layout == NODE_LAYOUT_COUNTED){
+		if((errorCode = convertToCounted()) < 0)
+			return errorCode;
+		return loadResident();
+	}
+	
+	if(rootPid > 0 && treeHeight > 0){
+		if((errorCode = convertNode(rootPid, treeHeight, layout)) < 0)
+			return errorCode;
+	}
+	//The header is written last, so it never claims a layout the nodes are not in yet
+	nodeLayout = layout;
+	if((errorCode = writeHeader()) < 0)
+		return errorCode;
+	return loadResident();
+}
+
+RC BTreeIndex::convertNode(PageId pid, int level, int layout)
+{
+	RC errorCode;
+	if(level == 1){
+		BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+		if((errorCode = leafNode.read(pid, pf)) < 0)
+			return errorCode;
+		if((errorCode = leafNode.setLayout(layout)) < 0)
+			return errorCode;
+		return leafNode.write(pid, pf);
+	}
+	
+	BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+	if((errorCode = nonLeafNode.read(pid, pf)) < 0)
+		return errorCode;
+	//Convert the children first, the node still has to be read in the old layout
+	for(int i = 0; i <= nonLeafNode.getKeyCount(); i++){
+		if((errorCode = convertNode(nonLeafNode.getChildPtr(i), level-1, layout)) < 0)
+			return errorCode;
+	}
+	if((errorCode = nonLeafNode.setLayout(layout)) < 0)
+		return errorCode;
+	return nonLeafNode.write(pid, pf);
+}
+
+/*
+ * Rewrite the index in NODE_LAYOUT_COUNTED. The leaves are converted in place,
+ * then the nonleaf levels are built again on top of them, in the pages of the
+ * old nonleaf nodes first.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::convertToCounted()
+{
+	RC errorCode;
+	vector<int> keys;
+	vector<int> sizes;
+	vector<PageId> pids;
+	vector<PageId> oldPids;
+	
+	if(rootPid > 0 && treeHeight > 0){
+		//Go down the tree a level at a time, the children of a level are in key order
+		pids.push_back(rootPid);
+		BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+		for(int level = treeHeight; level > 1; level--){
+			vector<PageId> children;
+			for(size_t i = 0; i < pids.size(); i++){
+				if((errorCode = nonLeafNode.pin(pids[i], pf)) < 0)
+					return errorCode;
+				for(int j = 0; j <= nonLeafNode.getKeyCount(); j++)
+					children.push_back(nonLeafNode.getChildPtr(j));
+			}
+			oldPids.insert(oldPids.end(), pids.begin(), pids.end());
+			pids.swap(children);
+		}
+		nonLeafNode.unpin();
+		
+		//Convert the leaves and note the first key and the # entries of each
+		for(size_t i = 0; i < pids.size(); i++){
+			BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+			int key = 0;
+			RecordId rid;
+			if((errorCode = leafNode.read(pids[i], pf)) < 0)
+				return errorCode;
+			if((errorCode = leafNode.setLayout(NODE_LAYOUT_COUNTED)) < 0)
+				return errorCode;
+			if((errorCode = leafNode.write(pids[i], pf)) < 0)
+				return errorCode;
+			leafNode.readEntry(0, key, rid);
+			keys.push_back(key);
+			sizes.push_back(leafNode.getKeyCount());
+		}
+		
+		nodeLayout = NODE_LAYOUT_COUNTED;
+		if((errorCode = buildUpperLevels(keys, pids, sizes, oldPids)) < 0)
+			return errorCode;
+	}
+	nodeLayout = NODE_LAYOUT_COUNTED;
+	return writeHeader();
 }
 
 /*
@@ -84,7 +402,7 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 		//Increment if rootPid is on the page where treeHeight and rootPid are stored
 		if(rootPid == 0)
 			rootPid ++;
-		BTLeafNode leafNode;
+		BTLeafNode leafNode(pf.pageSize(), nodeLayout);
 		if((errorCode = leafNode.insert(key, rid)) < 0)
 			return errorCode;
 		//Next node ptr should be undefined, end of tree
@@ -93,46 +411,236 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 		if((errorCode = leafNode.write(rootPid, pf)) < 0)
 			return errorCode;
 		treeHeight++;
+		leafCount = 1;
+		noteKey(key);
 		return 0;
 	}else{
 		//Tree is not empty, so traverse it
 		int sibKey = -1;
 		PageId sibPid = -1;
-		return traverseAndInsert(key, rid, rootPid, sibKey, sibPid, treeHeight);
+		int sibEntries = 0;
+		int height = treeHeight;
+		if((errorCode = traverseAndInsert(key, rid, rootPid, sibKey, sibPid, sibEntries, treeHeight)) < 0)
+			return errorCode;
+		noteKey(key);
+		//A new root moves every level down
+		if(treeHeight != height || residentStale)
+			return loadResident();
+		return 0;
+	}
+}
+
+/*
+ * Set how full bulkLoad() packs the nodes.
+ * @param percent[IN] the percentage of a node filled, 1 to 100
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::setFillFactor(int percent)
+{
+	if(percent < 1 || percent > 100)
+		return RC_INVALID_FILL_FACTOR;
+	fillPercent = percent;
+	return 0;
+}
+
+/*
+ * Set the memory each open index may use for its resident upper nodes.
+ * @param bytes[IN] the memory in bytes, 0 for none
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::setResidentMemory(int bytes)
+{
+	if(bytes < 0)
+		return RC_INVALID_CACHE_SIZE;
+	residentMemory = bytes;
+	return 0;
+}
+
+/*
+ * Return how many of maxKeys keys a bulk-loaded node holds, at least minKeys.
+ */
+static int fillCount(int maxKeys, int minKeys)
+{
+	int keys = maxKeys * BTreeIndex::getFillFactor() / 100;
+	if(keys < minKeys)
+		keys = minKeys;
+	return (keys < maxKeys) ? keys : maxKeys;
+}
+
+/*
+ * Build the index from the pairs in entries, in key order.
+ * An empty tree is built bottom-up: the leaves are written left to right,
+ * then each nonleaf level on top of the one below, every node once.
+ * A tree that already has entries gets the pairs inserted one by one.
+ * @param entries[IN] the pairs to index. sort() is called on it
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoad(IndexSorter& entries)
+{
+	RC errorCode;
+	int key;
+	RecordId rid;
+	
+	if((errorCode = entries.sort()) < 0)
+		return errorCode;
+	
+	if(rootPid != -1 && treeHeight != 0){
+		//Tree is not empty, insert in key order
+		while((errorCode = entries.next(key, rid)) == 0){
+			if((errorCode = insert(key, rid)) < 0)
+				return errorCode;
+		}
+		return (errorCode == RC_END_OF_TREE) ? 0 : errorCode;
 	}
+	
+	int total = entries.size();
+	if(total == 0)
+		return 0;
+	
+	//The first key, the pid and the # entries of every leaf
+	vector<int> keys;
+	vector<PageId> pids;
+	vector<int> sizes;
+	PageId pid = pf.endPid();
+	if(pid == 0)
+		pid++;
+	
+	//Leaves get consecutive pids, so each one points to the next pid.
+	//The entries are spread evenly, so no leaf is left almost empty
+	int perLeaf = fillCount(leafCapacity(pf.pageSize()), 1);
+	int leaves = (total + perLeaf - 1) / perLeaf;
+	for(int i = 0; i < leaves; i++){
+		BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+		int n = total / leaves + (i < total % leaves);
+		for(int j = 0; j < n; j++){
+			if((errorCode = entries.next(key, rid)) < 0)
+				return errorCode;
+			if((errorCode = leafNode.append(key, rid)) < 0)
+				return errorCode;
+			noteKey(key);
+			if(j == 0)
+				keys.push_back(key);
+		}
+		if((errorCode = leafNode.setNextNodePtr(i + 1 < leaves ? pid + 1 : RC_END_OF_TREE)) < 0)
+			return errorCode;
+		if((errorCode = leafNode.write(pid, pf)) < 0)
+			return errorCode;
+		pids.push_back(pid++);
+		sizes.push_back(n);
+	}
+	leafCount = leaves;
+	
+	if((errorCode = buildUpperLevels(keys, pids, sizes, vector<PageId>())) < 0)
+		return errorCode;
+	if((errorCode = writeHeader()) < 0)
+		return errorCode;
+	return loadResident();
 }
 
-RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &sibKey, PageId &sibPid, int level){
+/*
+ * Build the nonleaf levels of the tree on top of its leaves, each level from
+ * the one below, and make the single node of the top level the root.
+ * Nonleaf nodes are filled to the fill factor and written once, to the pages
+ * in freePids first, then after the end of the file.
+ * @param keys[IN] the first key of every leaf, in key order. It is used up
+ * @param pids[IN] the pid of every leaf. It is used up
+ * @param sizes[IN] the # entries of every leaf. It is used up
+ * @param freePids[IN] unused pages of the file
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::buildUpperLevels(vector<int>& keys, vector<PageId>& pids, vector<int>& sizes, const vector<PageId>& freePids)
+{
+	RC errorCode;
+	size_t used = 0;
+	treeHeight = 1;
+	
+	//Nonleaf nodes hold at least two keys, so spreading the children evenly never leaves a node with one child
+	int perNode = fillCount(nonLeafCapacity(pf.pageSize(), nodeLayout), 2) + 1;
+	while(pids.size() > 1){
+		vector<int> upperKeys;
+		vector<PageId> upperPids;
+		vector<int> upperSizes;
+		int children = pids.size();
+		int nodeCount = (children + perNode - 1) / perNode;
+		int first = 0;
+		for(int i = 0; i < nodeCount; i++){
+			BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+			int n = children / nodeCount + (i < children % nodeCount);
+			int total = sizes[first] + sizes[first+1];
+			//The key left of a child is the first key under it
+			if((errorCode = nonLeafNode.initializeRoot(pids[first], keys[first+1], pids[first+1], sizes[first], sizes[first+1])) < 0)
+				return errorCode;
+			for(int j = 2; j < n; j++){
+				if((errorCode = nonLeafNode.append(keys[first+j], pids[first+j], sizes[first+j])) < 0)
+					return errorCode;
+				total += sizes[first+j];
+			}
+			PageId pid = (used < freePids.size()) ? freePids[used++] : pf.endPid();
+			if((errorCode = nonLeafNode.write(pid, pf)) < 0)
+				return errorCode;
+			upperKeys.push_back(keys[first]);
+			upperPids.push_back(pid);
+			upperSizes.push_back(total);
+			first += n;
+		}
+		keys.swap(upperKeys);
+		pids.swap(upperPids);
+		sizes.swap(upperSizes);
+		treeHeight++;
+	}
+	
+	rootPid = pids[0];
+	return 0;
+}
+
+RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &sibKey, PageId &sibPid, int &sibEntries, int level){
 	RC errorCode;
 	if(level != 1){
 		//At a non-leaf level
-		BTNonLeafNode nonLeafNode;
-		if((errorCode = nonLeafNode.read(pid,pf)) < 0)
+		BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+		const char* resident = residentNode(pid);
+		if(resident != NULL)
+			nonLeafNode.view(resident);
+		else if((errorCode = nonLeafNode.read(pid,pf)) < 0)
 			return errorCode;
 		PageId traversePid;
-		if((errorCode = nonLeafNode.locateChildPtr(key, traversePid)) < 0)
+		int child;
+		if((errorCode = nonLeafNode.locateChildPtr(key, traversePid, child)) < 0)
 			return errorCode;
 		//Recursively insert
-		if((errorCode = traverseAndInsert(key, rid, traversePid, sibKey, sibPid, level-1)) < 0)
+		if((errorCode = traverseAndInsert(key, rid, traversePid, sibKey, sibPid, sibEntries, level-1)) < 0)
 			return errorCode;	
 		
-		if(sibKey != -1 && sibPid != -1){
+		//The child got the new entry, less the entries that moved to its new sibling
+		bool counted = (nodeLayout == NODE_LAYOUT_COUNTED);
+		//Any int is a key, so only sibPid tells whether the child split
+		bool split = (sibPid != -1);
+		if(counted){
+			int entries = nonLeafNode.getSubtreeSize(child) + 1 - (split ? sibEntries : 0);
+			if((errorCode = nonLeafNode.setSubtreeSize(child, entries)) < 0)
+				return errorCode;
+		}
+		
+		if(split){
 			//Insertion to nonLeafNode
-			if(nonLeafNode.getKeyCount() >= MAX_LEAF_RECORDS){
+			if(nonLeafNode.getKeyCount() >= nonLeafNode.getMaxKeyCount()){
 				//Nonleaf overflow
-				BTNonLeafNode siblingNode;
-				if((errorCode = nonLeafNode.insertAndSplit(sibKey, sibPid, siblingNode, sibKey)) < 0)
+				BTNonLeafNode siblingNode(pf.pageSize(), nodeLayout);
+				if((errorCode = nonLeafNode.insertAndSplit(sibKey, sibPid, siblingNode, sibKey, sibEntries, child)) < 0)
 					return errorCode;
 				sibPid = pf.endPid();
-				if((errorCode = nonLeafNode.write(pid, pf)) < 0)
+				if(counted)
+					sibEntries = siblingNode.getTotalSize();
+				if((errorCode = writeNonLeaf(nonLeafNode, pid)) < 0)
 					return errorCode;	
 				if((errorCode = siblingNode.write(sibPid, pf)) < 0)
 					return errorCode;					
 				//Need to initialize a new root
 				if(pid == rootPid){
 					rootPid = pf.endPid();
-					BTNonLeafNode rootNode;
-					if((errorCode = rootNode.initializeRoot(pid, sibKey, sibPid)) < 0)
+					BTNonLeafNode rootNode(pf.pageSize(), nodeLayout);
+					int entries = counted ? nonLeafNode.getTotalSize() : 0;
+					if((errorCode = rootNode.initializeRoot(pid, sibKey, sibPid, entries, sibEntries)) < 0)
 						return errorCode;
 					if((errorCode = rootNode.write(rootPid, pf)) < 0)
 						return errorCode;
@@ -141,27 +649,30 @@ RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &s
 				return 0;
 			}else{
 				//No overflow
-				if((errorCode = nonLeafNode.insert(sibKey,sibPid)) < 0)
+				if((errorCode = nonLeafNode.insert(sibKey, sibPid, sibEntries, child)) < 0)
 					return errorCode;
-				if((errorCode = nonLeafNode.write(pid, pf)) < 0)
+				if((errorCode = writeNonLeaf(nonLeafNode, pid)) < 0)
 					return errorCode;
 			
 				//Only need to add in record after split on the nonleaf node right above the leaf split. 
-				sibKey = -1;
 				sibPid = -1;
 				return 0;
 			}
+		}else if(counted){
+			//Only the entry count changed
+			if((errorCode = writeNonLeaf(nonLeafNode, pid)) < 0)
+				return errorCode;
 		}
 	}else{
 		//At the leaf level
-		BTLeafNode leafNode;
+		BTLeafNode leafNode(pf.pageSize(), nodeLayout);
 		if((errorCode = leafNode.read(pid,pf)) < 0)
 			return errorCode;
 		
 		//Insertion to leafNode
-		if(leafNode.getKeyCount() >= MAX_LEAF_RECORDS){
+		if(leafNode.getKeyCount() >= leafNode.getMaxKeyCount()){
 			//Leaf node overflow
-			BTLeafNode siblingNode;
+			BTLeafNode siblingNode(pf.pageSize(), nodeLayout);
 			sibPid = pf.endPid();
 			//Insert tuple and split
 			if((errorCode = leafNode.insertAndSplit(key, rid, siblingNode, sibKey)) < 0)
@@ -172,11 +683,13 @@ RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &s
 				return errorCode;	
 			if((errorCode = siblingNode.write(sibPid, pf)) < 0)
 				return errorCode;
+			leafCount++;
+			sibEntries = siblingNode.getKeyCount();
 			//Need to initialize a new root
 			if(pid == rootPid){				
 				rootPid = pf.endPid();
-				BTNonLeafNode rootNode;
-				if((errorCode = rootNode.initializeRoot(pid, sibKey, sibPid)) < 0)
+				BTNonLeafNode rootNode(pf.pageSize(), nodeLayout);
+				if((errorCode = rootNode.initializeRoot(pid, sibKey, sibPid, leafNode.getKeyCount(), sibEntries)) < 0)
 					return errorCode;
 				if((errorCode = rootNode.write(rootPid, pf)) < 0)
 					return errorCode;
@@ -192,6 +705,7 @@ RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &s
 			return 0;
 		}
 	}
+	return 0;
 }
 
 /*
@@ -216,7 +730,7 @@ RC BTreeIndex::traverseAndInsert(int key, const RecordId rid, PageId pid, int &s
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
 	RC errorCode = 0;
-	BTLeafNode leafNode;
+	BTLeafNode leafNode(pf.pageSize(), nodeLayout);
 	
 	//Check for if tree is empty
 	if(rootPid < 0 || treeHeight < 1){
@@ -227,12 +741,20 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 	if((errorCode = traverseToLeafNode (searchKey, cursor.pid)) < 0)
 		return errorCode;
 
-	//Read in the node and locate the entry number
-	if((errorCode = leafNode.read(cursor.pid, pf)) < 0){
+	//Pin the node and locate the entry number
+	if((errorCode = leafNode.pin(cursor.pid, pf)) < 0){
 		return errorCode;
 	}
+	if((errorCode = leafNode.locate(searchKey, cursor.eid)) < 0)
+		return errorCode;
 	
-	return leafNode.locate(searchKey, cursor.eid);
+	//Every key in the leaf is smaller than searchKey, so the entry is
+	//the first one of the next leaf (or the end of the tree)
+	if(cursor.eid >= leafNode.getKeyCount()){
+		cursor.pid = leafNode.getNextNodePtr();
+		cursor.eid = 0;
+	}
+	return 0;
 }
 
 /*
@@ -246,19 +768,19 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
 	if(cursor.pid == RC_END_OF_TREE)
-			return RC_END_OF_TREE;
+		return RC_END_OF_TREE;
 
-    if(cursor.pid < 0)
-        return RC_INVALID_PID;
+	if(cursor.pid < 0)
+		return RC_INVALID_PID;
 
 	if(cursor.eid < 0)
 		return RC_INVALID_EID;
 		
-	BTLeafNode leafNode;
+	BTLeafNode leafNode(pf.pageSize(), nodeLayout);
 	RC errorCode = 0;
 	
 	//get the record and key from the current location
-	if((errorCode = leafNode.read(cursor.pid, pf)) < 0)
+	if((errorCode = leafNode.pin(cursor.pid, pf)) < 0)
 		return errorCode;		
 	if((errorCode = leafNode.readEntry(cursor.eid, key, rid)) < 0)
 		return errorCode;
@@ -274,16 +796,261 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 	return errorCode;
 }
 
+/*
+ * Position the iterator at the first entry with a key larger than or
+ * equal to searchKey, pinning its leaf.
+ * @param key[IN] the key to find.
+ * @param it[OUT] the iterator pointing to the first index entry
+ *                with the key value.
+ * @return error code. 0 if no error.
+ */
+RC BTreeIndex::locate(int searchKey, IndexIterator& it)
+{
+	RC errorCode = 0;
+	
+	it.close();
+	//Check for if tree is empty
+	if(rootPid < 0 || treeHeight < 1){
+		return RC_TREE_EMPTY;
+	}
+	
+	//Traverse to leaf node and keep it pinned
+	if((errorCode = traverseToLeafNode(searchKey, it.cursor.pid)) < 0)
+		return errorCode;
+	if((errorCode = it.leaf.pin(it.cursor.pid, pf)) < 0){
+		it.cursor.pid = RC_END_OF_TREE;
+		return errorCode;
+	}
+	if((errorCode = it.leaf.locate(searchKey, it.cursor.eid)) < 0)
+		return errorCode;
+	
+	//Every key in the leaf is smaller than searchKey, so the entry is
+	//the first one of the next leaf (or the end of the tree)
+	if(it.cursor.eid >= it.leaf.getKeyCount())
+		return nextLeaf(it);
+	return 0;
+}
+
+/*
+ * Read the (key, rid) pair at the iterator and move it to the next entry.
+ * @param it[IN/OUT] the iterator pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the iterator location.
+ * @param rid[OUT] the RecordId stored at the iterator location.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readForward(IndexIterator& it, int& key, RecordId& rid)
+{
+	RC errorCode;
+	if(it.cursor.pid == RC_END_OF_TREE)
+		return RC_END_OF_TREE;
+	
+	if((errorCode = it.leaf.readEntry(it.cursor.eid, key, rid)) < 0)
+		return errorCode;
+	
+	//Only move to the next leaf at the end of this one
+	if(++it.cursor.eid >= it.leaf.getKeyCount())
+		return nextLeaf(it);
+	return 0;
+}
+
+/*
+ * Read up to n (key, rid) pairs starting at the iterator and move it past them.
+ * @param it[IN/OUT] the iterator pointing to an leaf-node index entry in the b+tree
+ * @param keys[OUT] the keys read
+ * @param rids[OUT] the RecordIds read
+ * @param n[IN] the size of keys and rids
+ * @param count[OUT] the number of pairs read
+ * @return error code. 0 if no error. RC_END_OF_TREE if no pair is left
+ */
+RC BTreeIndex::readForward(IndexIterator& it, int keys[], RecordId rids[], int n, int& count)
+{
+	RC errorCode;
+	count = 0;
+	if(it.cursor.pid == RC_END_OF_TREE)
+		return RC_END_OF_TREE;
+	
+	while(count < n && it.cursor.pid != RC_END_OF_TREE){
+		//Take as many entries as are wanted from the pinned leaf
+		int leafKeys = it.leaf.getKeyCount();
+		while(count < n && it.cursor.eid < leafKeys){
+			if((errorCode = it.leaf.readEntry(it.cursor.eid, keys[count], rids[count])) < 0)
+				return errorCode;
+			it.cursor.eid++;
+			count++;
+		}
+		if(it.cursor.eid >= leafKeys){
+			if((errorCode = nextLeaf(it)) < 0)
+				return errorCode;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Count the entries whose key is in [low, high].
+ * @param low[IN] the smallest key counted
+ * @param high[IN] the largest key counted
+ * @param count[OUT] the # entries
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countRange(int low, int high, int& count)
+{
+	RC errorCode;
+	count = 0;
+	if(rootPid < 0 || treeHeight < 1 || low > high)
+		return 0;
+	
+	if(nodeLayout == NODE_LAYOUT_COUNTED){
+		//The keys not above high are the keys less than high + 1, or all of them
+		int upTo, below;
+		if((errorCode = (high == INT_MAX) ? countAll(upTo) : countLess(high + 1, upTo)) < 0)
+			return errorCode;
+		if((errorCode = countLess(low, below)) < 0)
+			return errorCode;
+		count = upTo - below;
+		return 0;
+	}
+	
+	//Without entry counts, read the entries of the range
+	const int batchSize = 64;
+	int keys[batchSize];
+	RecordId rids[batchSize];
+	int n;
+	IndexIterator it(*this);
+	if((errorCode = locate(low, it)) < 0){
+		it.close();
+		return errorCode;
+	}
+	while((errorCode = readForward(it, keys, rids, batchSize, n)) == 0){
+		int b = 0;
+		while(b < n && keys[b] <= high)
+			b++;
+		count += b;
+		if(b < n)
+			break;
+	}
+	it.close();
+	return (errorCode == RC_END_OF_TREE) ? 0 : errorCode;
+}
+
+/*
+ * Count the entries whose key is smaller than key. On the path to the leftmost
+ * leaf that can hold key, every child pointer left of the one followed leads to
+ * smaller keys only, so their entry counts are added up, then the entries of
+ * the leaf before key. The index must be in NODE_LAYOUT_COUNTED.
+ */
+RC BTreeIndex::countLess(int key, int& count)
+{
+	RC errorCode;
+	PageId pid = rootPid;
+	count = 0;
+	
+	BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+	for(int level = treeHeight; level > 1; level--){
+		int child;
+		if((errorCode = pinNonLeaf(nonLeafNode, pid)) < 0)
+			return errorCode;
+		if((errorCode = nonLeafNode.locateChildPtr(key, pid, child)) < 0)
+			return errorCode;
+		for(int i = 0; i < child; i++)
+			count += nonLeafNode.getSubtreeSize(i);
+	}
+	nonLeafNode.unpin();
+	
+	//The entries before the first key not smaller than key
+	BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+	int eid = 0;
+	if((errorCode = leafNode.pin(pid, pf)) < 0)
+		return errorCode;
+	if((errorCode = leafNode.locate(key, eid)) < 0)
+		return errorCode;
+	count += eid;
+	return 0;
+}
+
+/*
+ * Count all the entries, from the entry counts of the root.
+ * The index must be in NODE_LAYOUT_COUNTED.
+ */
+RC BTreeIndex::countAll(int& count)
+{
+	RC errorCode;
+	count = 0;
+	if(treeHeight == 1){
+		BTLeafNode leafNode(pf.pageSize(), nodeLayout);
+		if((errorCode = leafNode.pin(rootPid, pf)) < 0)
+			return errorCode;
+		count = leafNode.getKeyCount();
+		return 0;
+	}
+	
+	BTNonLeafNode nonLeafNode(pf.pageSize(), nodeLayout);
+	if((errorCode = pinNonLeaf(nonLeafNode, rootPid)) < 0)
+		return errorCode;
+	count = nonLeafNode.getTotalSize();
+	return (count < 0) ? count : 0;
+}
+
+/*
+ * Move the iterator to the first entry of the next leaf and pin that leaf.
+ * At the end of the tree, the leaf is released and cursor.pid is RC_END_OF_TREE.
+ */
+RC BTreeIndex::nextLeaf(IndexIterator& it)
+{
+	RC errorCode;
+	//Skip empty leaves, which only an empty tree has
+	do{
+		it.cursor.pid = it.leaf.getNextNodePtr();
+		it.cursor.eid = 0;
+		if(it.cursor.pid == RC_END_OF_TREE){
+			it.leaf.unpin();
+			return 0;
+		}
+		if((errorCode = it.leaf.pin(it.cursor.pid, pf)) < 0){
+			it.close();
+			return errorCode;
+		}
+	}while(it.leaf.getKeyCount() == 0);
+	return 0;
+}
+
+IndexIterator::IndexIterator(const BTreeIndex& index)
+	: leaf(index.pf.pageSize(), index.nodeLayout)
+{
+	cursor.pid = RC_END_OF_TREE;
+	cursor.eid = 0;
+}
+
+/*
+ * Release the pinned leaf.
+ */
+void IndexIterator::close()
+{
+	leaf.unpin();
+	cursor.pid = RC_END_OF_TREE;
+	cursor.eid = 0;
+}
+
+/*
+ * Tell the OS how the index file is going to be accessed.
+ * @param pattern[IN] the expected access pattern
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::advise(PageFile::AccessPattern pattern) const
+{
+	return pf.advise(pattern);
+}
+
 RC BTreeIndex::traverseToLeafNode(int searchKey, PageId& leafPid)
 {
 	PageId currentPid = rootPid;
-	BTNonLeafNode NonLeafNode;
+	BTNonLeafNode NonLeafNode(pf.pageSize(), nodeLayout);
 	RC errorCode = 0;
 	//define NonLeafNode as root to start
 	//traverse down the tree
 	for(int i = 1; i < treeHeight; i++){
 		//for each tree level, find which node to follow
-		if((errorCode = NonLeafNode.read(currentPid, pf)) < 0)
+		if((errorCode = pinNonLeaf(NonLeafNode, currentPid)) < 0)
 			return errorCode;
 			
 		if((errorCode = NonLeafNode.locateChildPtr(searchKey, currentPid)) < 0)
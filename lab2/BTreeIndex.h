@@ -10,9 +10,15 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
+#include <utility>
+#include <vector>
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
+
+class IndexSorter;
+class IndexIterator;
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -33,6 +39,9 @@ typedef struct {
  */
 class BTreeIndex {
  public:
+  static const int DEFAULT_FILL_PERCENT = 90; /// how full bulkLoad() packs nodes unless set
+  static const int DEFAULT_RESIDENT_MEMORY = 1024*1024; /// bytes of upper nodes kept in memory unless set
+
   BTreeIndex();
   
   /**
@@ -58,13 +67,47 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
+  /**
+   * Add the (key, RecordId) pairs collected in entries to the index.
+   * An empty index is built bottom-up, with nodes filled to the fill factor
+   * and every page written once. Otherwise the pairs are inserted in key order.
+   * @param entries[IN] the pairs to add
+   * @return error code. 0 if no error
+   */
+  RC bulkLoad(IndexSorter& entries);
+
+  /**
+   * Set how full bulkLoad() packs the nodes of an empty index.
+   * @param percent[IN] the percentage of a node filled, 1 to 100
+   * @return error code. 0 if no error
+   */
+  static RC setFillFactor(int percent);
+  static int getFillFactor() { return fillPercent; }
+
+  /**
+   * Set the memory each open index may use to keep its upper nodes.
+   * From open() until close(), the root and as many of the levels below it
+   * as fit whole in this memory are kept in memory, so that finding a leaf
+   * reads no page of those levels. Leaves are never kept.
+   * @param bytes[IN] the memory in bytes. 0 keeps no node in memory
+   * @return error code. 0 if no error
+   */
+  static RC setResidentMemory(int bytes);
+  static int getResidentMemory() { return residentMemory; }
+
+  /**
+   * @return the # levels from the root down kept in memory
+   */
+  int getResidentLevels() const { return residentLevels; }
+
   /**
    * Recursively traverses to where tuple should be and inserts it into the tree. 
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
+   * @param sibEntries[OUT] the # leaf entries under sibPid if the node split
    * @return error code. 0 if no error
    */  
-  RC traverseAndInsert(int key, const RecordId rid, PageId pid, int &sibKey, PageId &sibPid, int level);
+  RC traverseAndInsert(int key, const RecordId rid, PageId pid, int &sibKey, PageId &sibPid, int &sibEntries, int level);
   
   /**
    * Find the leaf-node index entry whose key value is larger than or
@@ -97,6 +140,57 @@ class BTreeIndex {
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Position the iterator at the leaf-node index entry whose key value is
+   * larger than or equal to searchKey, like locate() with an IndexCursor.
+   * The leaf of the entry stays pinned in the iterator.
+   * @param key[IN] the key to find
+   * @param it[OUT] the iterator pointing to the first index entry
+   * with the key value
+   * @return error code. 0 if no error.
+   */
+  RC locate(int searchKey, IndexIterator& it);
+
+  /**
+   * Read the (key, rid) pair at the iterator, and move the iterator to the
+   * next entry. The next leaf is pinned only when the current one is used up.
+   * @param it[IN/OUT] the iterator pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the iterator location
+   * @param rid[OUT] the RecordId stored at the iterator location
+   * @return error code. 0 if no error. RC_END_OF_TREE after the last entry
+   */
+  RC readForward(IndexIterator& it, int& key, RecordId& rid);
+
+  /**
+   * Read up to n (key, rid) pairs starting at the iterator, and move the
+   * iterator past them.
+   * @param it[IN/OUT] the iterator pointing to an leaf-node index entry in the b+tree
+   * @param keys[OUT] the keys read
+   * @param rids[OUT] the RecordIds read
+   * @param n[IN] the size of keys and rids
+   * @param count[OUT] the number of pairs read. Less than n only at the end of the tree
+   * @return error code. 0 if no error. RC_END_OF_TREE if no pair is left
+   */
+  RC readForward(IndexIterator& it, int keys[], RecordId rids[], int n, int& count);
+
+  /**
+   * Count the entries whose key is in [low, high].
+   * With NODE_LAYOUT_COUNTED this takes one root-to-leaf descent per bound,
+   * adding up the entry counts of the child pointers left of the path.
+   * Other layouts read the leaves of the range.
+   * @param low[IN] the smallest key counted
+   * @param high[IN] the largest key counted
+   * @param count[OUT] the # entries
+   * @return error code. 0 if no error
+   */
+  RC countRange(int low, int high, int& count);
+
+  /**
+   * @return true if the nonleaf nodes keep the # entries under each child,
+   *         so countRange() does not read the leaves of the range
+   */
+  bool hasSubtreeSizes() const { return nodeLayout == NODE_LAYOUT_COUNTED; }
   
    /**
 	* Use the given search key to traverse the tree from the root to the leaf node
@@ -105,6 +199,35 @@ class BTreeIndex {
 	* @return error code. 0 if no error
 	*/
   RC traverseToLeafNode(int searchKey, PageId &leafNode);
+
+   /**
+	* Tell the OS how the index file is going to be accessed
+	* @param pattern[IN] the expected access pattern
+	* @return error code. 0 if no error
+	*/
+  RC advise(PageFile::AccessPattern pattern) const;
+
+  /**
+   * Statistics of the index, kept in the first page.
+   * hasStats() is false for an index written before they were kept
+   * that has only been opened in 'r' mode since.
+   */
+  bool hasStats() const { return treeHeight == 0 || entryCount > 0; }
+  int  getEntryCount() const { return entryCount; } /// # (key, rid) pairs
+  int  getLeafCount() const { return leafCount; }   /// # leaf nodes
+  int  getMinKey() const { return minKey; }         /// the smallest key
+  int  getMaxKey() const { return maxKey; }         /// the largest key
+  int  getTreeHeight() const { return treeHeight; } /// # levels, 1 for a single leaf
+
+   /**
+	* Rewrite every node of the index in another on-page layout and record
+	* the layout in the first page. The index must be open in 'w' mode.
+	* Opening an index of an older layout in 'w' mode converts it to NODE_LAYOUT_COUNTED.
+	* Converting to NODE_LAYOUT_COUNTED rebuilds the nonleaf levels, since they hold fewer keys.
+	* @param layout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+	* @return error code. 0 if no error
+	*/
+  RC convert(int layout);
   
  private:
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
@@ -115,6 +238,66 @@ class BTreeIndex {
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+  static int fillPercent; /// how full bulkLoad() packs nodes
+  static int residentMemory; /// the memory for the resident upper nodes of an index
+
+  int      nodeLayout; /// the on-page layout of the nodes (NODE_LAYOUT_*), stored after them
+  int      entryCount; /// statistics of the index, stored after nodeLayout
+  int      minKey;
+  int      maxKey;
+  int      leafCount;
+
+  int      residentLevels; /// # levels from the root whose nodes are kept in memory
+  std::vector<std::pair<PageId, int> > residentSlots; /// (pid, slot) of each resident node, by pid
+  std::vector<char> residentPages; /// the pages of the resident nodes, one per slot
+  bool     residentStale;  /// a resident node has a child that is not resident yet
+
+  friend class IndexIterator;
+
+  RC writeHeader();
+  RC nextLeaf(IndexIterator& it);
+  RC computeStats();
+  void noteKey(int key);
+  RC convertNode(PageId pid, int level, int layout);
+  RC convertToCounted();
+  RC buildUpperLevels(std::vector<int>& keys, std::vector<PageId>& pids, std::vector<int>& sizes,
+                      const std::vector<PageId>& freePids);
+  RC countLess(int key, int& count);
+  RC countAll(int& count);
+  RC loadResident();
+  void clearResident();
+  const char* residentNode(PageId pid) const;
+  RC pinNonLeaf(BTNonLeafNode& node, PageId pid) const;
+  RC writeNonLeaf(BTNonLeafNode& node, PageId pid);
+};
+
+/**
+ * A cursor over the leaf-node index entries that keeps the current leaf
+ * pinned between calls, so reading forward only looks up a page in the
+ * cache when it moves to the next leaf. It is positioned by
+ * BTreeIndex::locate() and advanced by BTreeIndex::readForward().
+ */
+class IndexIterator {
+ public:
+  /**
+   * @param index[IN] the open index the iterator reads
+   */
+  IndexIterator(const BTreeIndex& index);
+
+  /**
+   * Release the pinned leaf. This must be done before the index is closed.
+   */
+  void close();
+
+ private:
+  friend class BTreeIndex;
+
+  IndexCursor cursor; /// the next entry. pid is RC_END_OF_TREE at the end
+  BTLeafNode  leaf;   /// the leaf cursor.pid, pinned while it is read
+
+  // Iterators own a pin and cannot be copied
+  IndexIterator(const IndexIterator&);
+  IndexIterator& operator=(const IndexIterator&);
 };
 
 #endif /* BTREEINDEX_H */
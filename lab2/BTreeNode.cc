@@ -1,14 +1,143 @@
 #include "BTreeNode.h"
 #include <iostream> //testing
+#include <climits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
+/*
+* Count the keys smaller than searchKey in a block of at most SEARCH_BLOCK_KEYS keys.
+* Only the first n keys are read, the block may end at the end of the page.
+*/
+static inline int countBlockLess(const char* keys, int stride, int n, int searchKey)
+{
+#ifdef __AVX2__
+	//Gather the keys of the block into one register, masking out the lanes past n.
+	//Contiguous keys (NODE_LAYOUT_SOA) are loaded directly
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(n), lane);
+	__m256i block;
+	if(stride == sizeof(int)){
+		block = _mm256_maskload_epi32((const int*)keys, valid);
+		block = _mm256_blendv_epi8(_mm256_set1_epi32(INT_MAX), block, valid);
+	}else{
+		__m256i offsets = _mm256_mullo_epi32(lane, _mm256_set1_epi32(stride));
+		block = _mm256_mask_i32gather_epi32(_mm256_set1_epi32(INT_MAX), (const int*)keys, offsets, valid, 1);
+	}
+	__m256i less = _mm256_cmpgt_epi32(_mm256_set1_epi32(searchKey), block);
+	return __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+#elif defined(__SSE2__)
+	//Compare the keys four at a time. Lanes past n hold INT_MAX and never count
+	int block[SEARCH_BLOCK_KEYS];
+	for(int i = 0; i < SEARCH_BLOCK_KEYS; i++)
+		block[i] = INT_MAX;
+	if(stride == sizeof(int))
+		memcpy(block, keys, n*sizeof(int));
+	else
+		for(int i = 0; i < n; i++)
+			memcpy(&block[i], keys + i*stride, sizeof(int));
+	__m128i key = _mm_set1_epi32(searchKey);
+	__m128i lo = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)block), key);
+	__m128i hi = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(block + 4)), key);
+	return __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lo)) | (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4));
+#else
+	//The keys are sorted, so the count of smaller keys is the position of searchKey
+	int count = 0;
+	for(int i = 0; i < n; i++){
+		int key;
+		memcpy(&key, keys + i*stride, sizeof(int));
+		count += (key < searchKey);
+	}
+	return count;
+#endif
+}
+
+/*
+* Count the keys smaller than searchKey among n sorted keys stride bytes apart.
+* @param keys[IN] pointer to the first key
+* @param stride[IN] distance between two keys in bytes
+* @param n[IN] the number of keys
+* @param searchKey[IN] the key to search for
+* @return the number of keys smaller than searchKey
+*/
+int countKeysLess(const char* keys, int stride, int n, int searchKey)
+{
+	const char* base = keys;
+	//Halve the range on every step. The answer always lies in [base, base+n],
+	//and the compare only selects the new base, so no branch is mispredicted
+	while(n > SEARCH_BLOCK_KEYS){
+		int half = n / 2;
+		int key;
+		memcpy(&key, base + (half-1)*stride, sizeof(int));
+		base = (key < searchKey) ? base + half*stride : base;
+		n -= half;
+	}
+	return (int)((base - keys) / stride) + countBlockLess(base, stride, n, searchKey);
+}
+
+/*
+* Offsets of the parts of entry eid in a node page.
+* NODE_LAYOUT_INTERLEAVED stores each leaf entry as (rid, key) and a nonleaf node as
+* pid0, key0, pid1, key1, ... NODE_LAYOUT_SOA stores all keys at the start of the
+* page, followed by all rids (leaf) or all pids (nonleaf). The keys array has room for
+* maxKeys keys in a leaf and one more in a nonleaf node, for the overflow of a split.
+* NODE_LAYOUT_COUNTED places keys, rids and pids as NODE_LAYOUT_SOA does and adds the
+* entry counts of the child pointers of a nonleaf node after the pids, which only
+* that layout has.
+*/
+static inline int leafKeyOffset(int layout, int eid)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED)
+		return sizeof(int)*eid;
+	return keyRecordComponentSize*eid + sizeof(RecordId);
+}
+
+static inline int leafRidOffset(int layout, int maxKeys, int eid)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED)
+		return sizeof(int)*maxKeys + sizeof(RecordId)*eid;
+	return keyRecordComponentSize*eid;
+}
+
+static inline int nonLeafKeyOffset(int layout, int eid)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED)
+		return sizeof(int)*eid;
+	return keyPageComponentSize*eid + sizeof(PageId);
+}
+
+static inline int nonLeafPidOffset(int layout, int maxKeys, int eid)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED)
+		return sizeof(int)*(maxKeys+1) + sizeof(PageId)*eid;
+	return keyPageComponentSize*eid;
+}
+
+static inline int nonLeafSizeOffset(int maxKeys, int eid)
+{
+	return sizeof(int)*(maxKeys+1) + sizeof(PageId)*(maxKeys+2) + sizeof(int)*eid;
+}
+
 //Initialize private variables
-BTLeafNode::BTLeafNode()
+BTLeafNode::BTLeafNode(int pageSize, int layout)
 {
 	tupleCount = 0;
+	this->pageSize = pageSize;
+	this->layout = layout;
+	maxKeys = leafCapacity(pageSize);
 	//Set every value in buffer to 0. This makes it easier mplementing cases where no keys exist.
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	memset(buffer, 0, pageSize);
+	page = buffer;
+	pinnedFile = NULL;
+}
+
+BTLeafNode::~BTLeafNode()
+{
+	unpin();
 }
 
 /*
@@ -20,11 +149,59 @@ BTLeafNode::BTLeafNode()
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 {
 	RC errorCode;
+	unpin();
 	if((errorCode = pf.read(pid,buffer)) < 0)
 		return errorCode;
-	memcpy(&tupleCount, buffer+PageFile::PAGE_SIZE-sizeof(int), sizeof(int));
+	pageSize = pf.pageSize();
+	maxKeys = leafCapacity(pageSize);
+	memcpy(&tupleCount, buffer+pageSize-sizeof(int), sizeof(int));
+	return 0;
+}
+
+/*
+* Pin the page pid in the PageFile pf and use it as the content of the node.
+* @param pid[IN] the PageId to pin
+* @param pf[IN] PageFile to pin the page from
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTLeafNode::pin(PageId pid, const PageFile& pf)
+{
+	RC errorCode;
+	const char* pinned;
+	if((errorCode = pf.pin(pid, pinned)) < 0)
+		return errorCode;
+	//Release the previous page only after the new one is pinned
+	unpin();
+	page = pinned;
+	pinnedFile = &pf;
+	pageSize = pf.pageSize();
+	maxKeys = leafCapacity(pageSize);
+	memcpy(&tupleCount, page+pageSize-sizeof(int), sizeof(int));
 	return 0;
 }
+
+/*
+* Release the page pinned by pin(), if any.
+*/
+void BTLeafNode::unpin()
+{
+	if(pinnedFile != NULL){
+		pinnedFile->unpin(page);
+		pinnedFile = NULL;
+	}
+	page = buffer;
+}
+
+/*
+* Copy a pinned page into buffer so that the node can be modified.
+*/
+void BTLeafNode::makeWritable()
+{
+	if(page != buffer){
+		memcpy(buffer, page, pageSize);
+		unpin();
+	}
+}
     
 /*
 * Write the content of the node to the page pid in the PageFile pf.
@@ -34,7 +211,11 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
 */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 {
-	memcpy(buffer+PageFile::PAGE_SIZE-sizeof(int), &tupleCount, sizeof(int));
+	//The node layout depends on the page size, so it cannot move between page sizes
+	if(pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
+	makeWritable();
+	memcpy(buffer+pageSize-sizeof(int), &tupleCount, sizeof(int));
 	return pf.write(pid, buffer);
 }
 
@@ -47,6 +228,15 @@ int BTLeafNode::getKeyCount()
 	return tupleCount;
 }
 
+/*
+* Return the number of keys the node can hold before it has to be split.
+* @return the maximum number of keys in the node
+*/
+int BTLeafNode::getMaxKeyCount()
+{
+	return maxKeys;
+}
+
 /*
 * Insert a (key, rid) pair to the node.
 * @param key[IN] the key to insert
@@ -55,23 +245,17 @@ int BTLeafNode::getKeyCount()
 */
 RC BTLeafNode::insert(int key, const RecordId& rid)
 {
-	if(tupleCount < MAX_LEAF_RECORDS){
+	makeWritable();
+	if(tupleCount < maxKeys){
 		RC rc;
 		int eid;
 		rc = locate(key, eid);
 		if(rc == 0){
-			int offset = (sizeof(RecordId) + sizeof(int))*eid;
-			//Create a temporary buffer that stores all tuples that have to be shifted
-			int shiftSize = (keyRecordComponentSize)*(tupleCount - eid);
-			char *tempBuffer = (char *)malloc(shiftSize * sizeof(char));
-			memcpy(tempBuffer, buffer + offset, shiftSize);
-			//Insert new tuple
-			memcpy(buffer + offset, &rid, sizeof(RecordId));
-			memcpy(buffer + offset + sizeof(RecordId), &key, sizeof(int));
-			//Shift the tuples after insert
-			memcpy(buffer + offset + keyRecordComponentSize, tempBuffer, shiftSize);
+			//Shift the tuples after eid by one and insert the new tuple
+			moveEntries(eid, eid+1, tupleCount - eid);
+			memcpy(buffer + ridOffset(eid), &rid, sizeof(RecordId));
+			memcpy(buffer + keyOffset(eid), &key, sizeof(int));
 			tupleCount++;
-			free(tempBuffer);
 			return 0;
 		}
 	}
@@ -79,6 +263,23 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 	return RC_NODE_FULL;
 }
 
+/*
+* Append a (key, rid) pair after the last entry of the node.
+* @param key[IN] the key to append. It must not be smaller than the last key
+* @param rid[IN] the RecordId to append
+* @return 0 if successful. Return an error code if the node is full.
+*/
+RC BTLeafNode::append(int key, const RecordId& rid)
+{
+	makeWritable();
+	if(tupleCount >= maxKeys)
+		return RC_NODE_FULL;
+	memcpy(buffer + ridOffset(tupleCount), &rid, sizeof(RecordId));
+	memcpy(buffer + keyOffset(tupleCount), &key, sizeof(int));
+	tupleCount++;
+	return 0;
+}
+
 /*
 * Insert the (key, rid) pair to the node
 * and split the node half and half with sibling.
@@ -92,55 +293,48 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                               BTLeafNode& sibling, int& siblingKey)
 {
+	makeWritable();
 	//Make sure node is full
-	if(tupleCount < MAX_LEAF_RECORDS){ 
+	if(tupleCount < maxKeys){ 
         return RC_NODE_NOT_FULL;
   }
 	
 	//Get the entry id where the tuple should be entered 
-	int eid = 0;
-	for(; eid<tupleCount; eid++){
-		int curKey;
-		RecordId rid;
-		readEntry(eid, curKey, rid);
-		if(curKey >= key)
-			break;
-	}
+	int eid = countKeysLess(buffer + keyOffset(0), keyStride(), tupleCount, key);
 	
-	int start = MAX_LEAF_RECORDS/2;
-	//Split will be uneven unless start is changed in this case, entry inserted into sibling and MAX_LEAF_RECORDS is odd
-	if(eid > MAX_LEAF_RECORDS/2 && MAX_LEAF_RECORDS % 2 == 1)
-		start = MAX_LEAF_RECORDS/2 + 1;
+	int start = maxKeys/2;
+	//Split will be uneven unless start is changed in this case, entry inserted into sibling and maxKeys is odd
+	if(eid > maxKeys/2 && maxKeys % 2 == 1)
+		start = maxKeys/2 + 1;
 	
 	
 	//Insert entries to sibling
-	for(int sid=start; sid < MAX_LEAF_RECORDS; sid++){
+	for(int sid=start; sid < maxKeys; sid++){
 		int key;
 		RecordId rid;
 		readEntry(sid, key, rid);
 		sibling.insert(key, rid);
-		//Set siblingKey as first key value
-		if(sid == start){
-			siblingKey = key;
-		}
 	}
 
 	
 	//Delete tuples from the original node
 	PageId currentNextPid = getNextNodePtr();
-	int offset = (start)*(sizeof(RecordId) + sizeof(int));
-	memset(buffer + offset, 0, PageFile::PAGE_SIZE-offset);
+	clearEntries(start, tupleCount - start);
 	
 	//Set new key count and next node ptr
 	tupleCount = start;
 	sibling.setNextNodePtr(currentNextPid);
 
 	//Insert new node depending on where entry id is at
-	if(eid <= MAX_LEAF_RECORDS/2)
+	if(eid <= maxKeys/2)
 		insert(key, rid);
 	else
 		sibling.insert(key,rid);
 
+	//Set siblingKey as first key value. With an odd maxKeys the new key can be the first one
+	RecordId firstRid;
+	sibling.readEntry(0, siblingKey, firstRid);
+
 	//Set pageid of next node outside of this function
 	return 0;
 }
@@ -155,17 +349,8 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-	for(eid=0; eid<MAX_LEAF_RECORDS; eid++){
-		int key;
-		int offset = (keyRecordComponentSize)*eid;
-		memcpy(&key, buffer + offset + sizeof(RecordId), sizeof(int));
-		//assume that no keys added can be 0
-		if(key >= searchKey || key == 0)
-			return 0;
-	}
-
-	//Should only hit here if node is full and calling locate
-	return RC_NODE_FULL;
+	eid = countKeysLess(page + keyOffset(0), keyStride(), tupleCount, searchKey);
+	return 0;
 }
 
 /*
@@ -182,9 +367,8 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 		return RC_INVALID_ATTRIBUTE;
 	}
 
-	int offset = (keyRecordComponentSize)*eid;
-	memcpy(&rid, buffer + offset, sizeof(RecordId));
-	memcpy(&key, buffer + offset + sizeof(RecordId), sizeof(int));
+	memcpy(&rid, page + ridOffset(eid), sizeof(RecordId));
+	memcpy(&key, page + keyOffset(eid), sizeof(int));
 	return 0;
 	
 }
@@ -196,7 +380,7 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 PageId BTLeafNode::getNextNodePtr()
 {
 	PageId pid;
-	memcpy(&pid, buffer+PageFile::PAGE_SIZE-sizeof(int)-sizeof(PageId), sizeof(PageId));
+	memcpy(&pid, page+pageSize-sizeof(int)-sizeof(PageId), sizeof(PageId));
 	return pid;
 }
 
@@ -208,16 +392,103 @@ PageId BTLeafNode::getNextNodePtr()
 RC BTLeafNode::setNextNodePtr(PageId pid)
 {
 	if(pid >= 0 || pid == RC_END_OF_TREE){
-		memcpy(buffer+PageFile::PAGE_SIZE-sizeof(int)-sizeof(PageId), &pid, sizeof(PageId));
+		makeWritable();
+		memcpy(buffer+pageSize-sizeof(int)-sizeof(PageId), &pid, sizeof(PageId));
 		return 0;
 	}
 	return RC_INVALID_PID;
 }
 
-BTNonLeafNode::BTNonLeafNode()
+/*
+* Return the on-page layout of the node entries.
+* @return NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+*/
+int BTLeafNode::getLayout()
+{
+	return layout;
+}
+
+/*
+* Rearrange the entries of the node into another on-page layout.
+* @param newLayout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTLeafNode::setLayout(int newLayout)
+{
+	if(!isNodeLayout(newLayout))
+		return RC_INVALID_FILE_FORMAT;
+	makeWritable();
+	if(newLayout == layout)
+		return 0;
+	
+	//Copy the entries out of the old layout, the trailer stays where it is
+	char old[PageFile::MAX_PAGE_SIZE];
+	int oldLayout = layout;
+	memcpy(old, buffer, pageSize);
+	memset(buffer, 0, pageSize - sizeof(PageId) - sizeof(int));
+	layout = newLayout;
+	for(int eid = 0; eid < tupleCount; eid++){
+		memcpy(buffer + ridOffset(eid), old + leafRidOffset(oldLayout, maxKeys, eid), sizeof(RecordId));
+		memcpy(buffer + keyOffset(eid), old + leafKeyOffset(oldLayout, eid), sizeof(int));
+	}
+	return 0;
+}
+
+int BTLeafNode::keyOffset(int eid)
+{
+	return leafKeyOffset(layout, eid);
+}
+
+int BTLeafNode::ridOffset(int eid)
+{
+	return leafRidOffset(layout, maxKeys, eid);
+}
+
+int BTLeafNode::keyStride()
+{
+	return (layout != NODE_LAYOUT_INTERLEAVED) ? sizeof(int) : keyRecordComponentSize;
+}
+
+/*
+* Move n entries starting at entry from so that they start at entry to.
+*/
+void BTLeafNode::moveEntries(int from, int to, int n)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED){
+		memmove(buffer + keyOffset(to), buffer + keyOffset(from), n*sizeof(int));
+		memmove(buffer + ridOffset(to), buffer + ridOffset(from), n*sizeof(RecordId));
+	}else{
+		memmove(buffer + ridOffset(to), buffer + ridOffset(from), n*keyRecordComponentSize);
+	}
+}
+
+/*
+* Zero n entries starting at entry from.
+*/
+void BTLeafNode::clearEntries(int from, int n)
+{
+	if(layout != NODE_LAYOUT_INTERLEAVED){
+		memset(buffer + keyOffset(from), 0, n*sizeof(int));
+		memset(buffer + ridOffset(from), 0, n*sizeof(RecordId));
+	}else{
+		memset(buffer + ridOffset(from), 0, n*keyRecordComponentSize);
+	}
+}
+
+BTNonLeafNode::BTNonLeafNode(int pageSize, int layout)
 {
 	tupleCount = 0;
-	memset(buffer, 0, PageFile::PAGE_SIZE);
+	this->pageSize = pageSize;
+	this->layout = layout;
+	maxKeys = nonLeafCapacity(pageSize, layout);
+	memset(buffer, 0, pageSize);
+	page = buffer;
+	pinnedFile = NULL;
+}
+
+BTNonLeafNode::~BTNonLeafNode()
+{
+	unpin();
 }
 
 /*
@@ -229,11 +500,70 @@ BTNonLeafNode::BTNonLeafNode()
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 {
 	RC errorCode;
+	unpin();
 	if((errorCode = pf.read(pid,buffer)) < 0)
 		return errorCode;
-	memcpy(&tupleCount, buffer+PageFile::PAGE_SIZE-sizeof(int), sizeof(int));
+	pageSize = pf.pageSize();
+	maxKeys = nonLeafCapacity(pageSize, layout);
+	memcpy(&tupleCount, buffer+pageSize-sizeof(int), sizeof(int));
+	return 0;
+}
+
+/*
+* Pin the page pid in the PageFile pf and use it as the content of the node.
+* @param pid[IN] the PageId to pin
+* @param pf[IN] PageFile to pin the page from
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTNonLeafNode::pin(PageId pid, const PageFile& pf)
+{
+	RC errorCode;
+	const char* pinned;
+	if((errorCode = pf.pin(pid, pinned)) < 0)
+		return errorCode;
+	//Release the previous page only after the new one is pinned
+	unpin();
+	page = pinned;
+	pinnedFile = &pf;
+	pageSize = pf.pageSize();
+	maxKeys = nonLeafCapacity(pageSize, layout);
+	memcpy(&tupleCount, page+pageSize-sizeof(int), sizeof(int));
 	return 0;
 }
+
+/*
+* Release the page pinned by pin(), if any.
+*/
+void BTNonLeafNode::unpin()
+{
+	if(pinnedFile != NULL){
+		pinnedFile->unpin(page);
+		pinnedFile = NULL;
+	}
+	page = buffer;
+}
+
+/*
+* Use a copy of the node kept by the caller as the content of the node.
+* @param content[IN] the page of the node
+*/
+void BTNonLeafNode::view(const char* content)
+{
+	unpin();
+	page = content;
+	memcpy(&tupleCount, page+pageSize-sizeof(int), sizeof(int));
+}
+
+/*
+* Copy a pinned page into buffer so that the node can be modified.
+*/
+void BTNonLeafNode::makeWritable()
+{
+	if(page != buffer){
+		memcpy(buffer, page, pageSize);
+		unpin();
+	}
+}
     
 /*
 * Write the content of the node to the page pid in the PageFile pf.
@@ -243,7 +573,11 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 {
-	memcpy(buffer+PageFile::PAGE_SIZE-sizeof(int), &tupleCount, sizeof(int));
+	//The node layout depends on the page size, so it cannot move between page sizes
+	if(pf.pageSize() != pageSize)
+		return RC_INVALID_PAGE_SIZE;
+	makeWritable();
+	memcpy(buffer+pageSize-sizeof(int), &tupleCount, sizeof(int));
 	return pf.write(pid, buffer);
 }
 
@@ -256,6 +590,15 @@ int BTNonLeafNode::getKeyCount()
 	return tupleCount;
 }
 
+/*
+* Return the number of keys the node can hold before it has to be split.
+* @return the maximum number of keys in the node
+*/
+int BTNonLeafNode::getMaxKeyCount()
+{
+	return maxKeys;
+}
+
 /*
 * Change the counter stating the number of keys stored in a node.
 * @update tupleCount
@@ -271,6 +614,7 @@ void BTNonLeafNode::changeKeyCount(const int& newKeyCount)
 */
 char* BTNonLeafNode::getBufferPointer()
 {
+	makeWritable();
 	return &(buffer[0]);
 }
 
@@ -278,44 +622,43 @@ char* BTNonLeafNode::getBufferPointer()
 * Insert a (key, pid) pair to the node.
 * @param key[IN] the key to insert
 * @param pid[IN] the PageId to insert
+* @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+* @param child[IN] the pointer number of the child that pid was split from, or -1
 * @return 0 if successful. Return an error code if the node is full.
 */
-RC BTNonLeafNode::insert(int key, PageId pid)
+RC BTNonLeafNode::insert(int key, PageId pid, int entries, int child)
 {		
+	makeWritable();
 	if(pid < 0){
 		return RC_INVALID_PID;
 	}
 
-	if(tupleCount >= MAX_LEAF_RECORDS){
+	if(tupleCount >= maxKeys){
 		return RC_NODE_FULL;
 	}
 	
-	int eid = 0;
-	for(; eid<tupleCount; eid++){
-		int curKey;
-		int offset = (keyPageComponentSize)*eid;
-		memcpy(&curKey, buffer + offset + sizeof(PageId), sizeof(int));
-		//Skip first pid, add key then pid after unlike leaf node
-		if(curKey >= key){
-			int shiftSize = (keyPageComponentSize)*(tupleCount - eid);
-			
-			//Shift tuples
-			memmove(buffer + keyPageComponentSize*(eid+1) + sizeof(PageId), buffer + (keyPageComponentSize)*eid + sizeof(PageId), shiftSize);
-			
-			//Insert new tuple
-			memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId), &key, sizeof(int));
-			memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId) + sizeof(int), &pid, sizeof(PageId));
-			
-			tupleCount++;
-			return 0;
-		}
-	}
-	
-	//Key is greater than all other keys in the node. Add it in at the end.
-	//Will never have a key that is smaller than everything else because of the way we initialize and insert
-	memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId), &key, sizeof(int));
-	memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId) + sizeof(int), &pid, sizeof(PageId));
-	tupleCount++;
+	//If the key is greater than all other keys in the node, it is added at the end.
+	//Among equal keys only the child it was split from tells where it goes
+	int eid = (child >= 0) ? child : countKeysLess(buffer + keyOffset(0), keyStride(), tupleCount, key);
+	insertEntry(eid, key, pid, entries);
+	return 0;
+}
+
+/*
+* Append a (key, pid) pair after the last key of the node.
+* @param key[IN] the key to append. It must not be smaller than the last key
+* @param pid[IN] the PageId to append right of the key
+* @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+* @return 0 if successful. Return an error code if the node is full.
+*/
+RC BTNonLeafNode::append(int key, PageId pid, int entries)
+{
+	makeWritable();
+	if(pid < 0)
+		return RC_INVALID_PID;
+	if(tupleCount >= maxKeys)
+		return RC_NODE_FULL;
+	insertEntry(tupleCount, key, pid, entries);
 	return 0;
 }
 
@@ -327,62 +670,57 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 * @param pid[IN] the PageId to insert
 * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
 * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+* @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+* @param child[IN] the pointer number of the child that pid was split from, or -1
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int entries, int child)
 {
-	int numberOfCopiedTuples = (MAX_LEAF_RECORDS)/2;
+	makeWritable();
+	int numberOfCopiedTuples = (maxKeys)/2;
 	//make sure sibling node is empty (since constructor makes all values 0, we should be able to safely check if all values are 0
 	char* siblingBuffer = sibling.getBufferPointer();
-	for (int i = 0; i < PageFile::PAGE_SIZE ; i++){
+	for (int i = 0; i < sibling.pageSize ; i++){
 		if (siblingBuffer[i] != 0)
 			return RC_SIB_NOT_EMPTY;
 	}
 	
 	//Make sure node is full
-	if(tupleCount < MAX_LEAF_RECORDS){ 
+	if(tupleCount < maxKeys){ 
         return RC_NODE_NOT_FULL;
     }
 	
-	//Insert tuple into node, node will overflow, but buffer should have enough excess space to hold the overflow
-	int eid = 0;
-	for(; eid<MAX_LEAF_RECORDS; eid++){
-		int curKey;
-		int offset = (keyPageComponentSize)*eid;
-		memcpy(&curKey, buffer + offset + sizeof(PageId), sizeof(int));
-		//Skip first pid, add key then pid after unlike leaf node
-		if(curKey >= key){
-			int shiftSize = (keyPageComponentSize)*(tupleCount - eid);
-			
-			//Shift tuples
-			memmove(buffer + keyPageComponentSize*(eid+1) + sizeof(PageId), buffer + (keyPageComponentSize)*eid + sizeof(PageId), shiftSize);
-			
-			//Insert new tuple
-			memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId), &key, sizeof(int));
-			memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId) + sizeof(int), &pid, sizeof(PageId));
-			tupleCount++;
-			break;
-		}
-	}
+	//Insert tuple into node, node will overflow, but buffer should have enough excess space to hold the overflow.
+	//A key greater than all other keys goes at the end
+	int eid = (child >= 0) ? child : countKeysLess(buffer + keyOffset(0), keyStride(), tupleCount, key);
+	insertEntry(eid, key, pid, entries);
 	
-	//Key is greater than all other keys in the node. Add it in at the end.
-	//Will never have a key that is smaller than everything else because of the way we initialize and insert	
-	if(eid == MAX_LEAF_RECORDS){
-		memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId), &key, sizeof(int));
-		memcpy(buffer + keyPageComponentSize*(eid) + sizeof(PageId) + sizeof(int), &pid, sizeof(PageId));
-		tupleCount++;
+	//move (smaller) half of the tuples into the sibling buffer and then make sure the original node is clean.
+	//The sibling gets the keys from first on and the pids around them
+	int first = tupleCount - numberOfCopiedTuples;
+	for(int i = 0; i < numberOfCopiedTuples; i++)
+		memcpy(siblingBuffer + sibling.keyOffset(i), buffer + keyOffset(first + i), sizeof(int));
+	for(int i = 0; i <= numberOfCopiedTuples; i++)
+		memcpy(siblingBuffer + sibling.pidOffset(i), buffer + pidOffset(first + i), sizeof(PageId));
+	//The entry counts go with their pids
+	if(layout == NODE_LAYOUT_COUNTED && sibling.layout == NODE_LAYOUT_COUNTED){
+		for(int i = 0; i <= numberOfCopiedTuples; i++)
+			memcpy(siblingBuffer + sibling.sizeOffset(i), buffer + sizeOffset(first + i), sizeof(int));
 	}
 	
-	//move (smaller) half of the tuples into the sibling buffer and then make sure the original node is clean
-	memmove(siblingBuffer, buffer + (keyPageComponentSize*(tupleCount - numberOfCopiedTuples)),(keyPageComponentSize*numberOfCopiedTuples) + sizeof(PageId));
-	memset(buffer + (keyPageComponentSize*(tupleCount - numberOfCopiedTuples)),0, (keyPageComponentSize*numberOfCopiedTuples) + sizeof(PageId));
-	
-	//get midKey and remove that key
-	memcpy(&midKey, buffer + (keyPageComponentSize*(MAX_LEAF_RECORDS - numberOfCopiedTuples)) + sizeof(PageId), sizeof(int));
-	memset(buffer + (keyPageComponentSize*(MAX_LEAF_RECORDS - numberOfCopiedTuples)) + sizeof(PageId),0, sizeof(int));
+	//get midKey, the key left of the moved pids, and remove the moved tuples and midKey
+	memcpy(&midKey, buffer + keyOffset(first - 1), sizeof(int));
+	for(int i = first - 1; i < tupleCount; i++)
+		memset(buffer + keyOffset(i), 0, sizeof(int));
+	for(int i = first; i <= tupleCount; i++)
+		memset(buffer + pidOffset(i), 0, sizeof(PageId));
+	if(layout == NODE_LAYOUT_COUNTED){
+		for(int i = first; i <= tupleCount; i++)
+			memset(buffer + sizeOffset(i), 0, sizeof(int));
+	}
 	
 	//update key count for both nodes
-	changeKeyCount(MAX_LEAF_RECORDS - numberOfCopiedTuples);
+	changeKeyCount(maxKeys - numberOfCopiedTuples);
 	sibling.changeKeyCount(numberOfCopiedTuples);
 		
 	//Set midkey to parent node outside function	
@@ -398,21 +736,26 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 */
 RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 {
-	if(searchKey <= 0){
-		return RC_INVALID_KEY;
-	}
-	
-	for(int eid=0; eid<tupleCount; eid++){
-		int key;
-		memcpy(&key, buffer + (keyPageComponentSize*eid) + sizeof(PageId), sizeof(int));
-		if(key >= searchKey){
-			memcpy(&pid, buffer + (keyPageComponentSize*eid), sizeof(PageId));
-			return 0;
-		}
-	}
+	int i;
+	return locateChildPtr(searchKey, pid, i);
+}
 
-	//if it is not smaller than any of the other nodes, return the last node
-	memcpy(&pid, buffer + (keyPageComponentSize*tupleCount), sizeof(PageId));
+/*
+* Given the searchKey, find the child-node pointer to follow and
+* output it in pid and its number in i.
+* @param searchKey[IN] the searchKey that is being looked up.
+* @param pid[OUT] the pointer to the child node to follow.
+* @param i[OUT] the pointer number of pid
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid, int& i)
+{
+	//Follow the pointer left of the first key not smaller than searchKey.
+	//Duplicates of a separator can be on either side of it, so the leftmost
+	//child that can hold searchKey is taken and the search goes right from there.
+	//If searchKey is larger than all of the keys, this is the last pointer
+	i = countKeysLess(page + keyOffset(0), keyStride(), tupleCount, searchKey);
+	memcpy(&pid, page + pidOffset(i), sizeof(PageId));
 	return 0;
 }
 
@@ -421,19 +764,178 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
 * @param pid1[IN] the first PageId to insert
 * @param key[IN] the key that should be inserted between the two PageIds
 * @param pid2[IN] the PageId to insert behind the key
+* @param entries1[IN] the # leaf entries under pid1 (NODE_LAYOUT_COUNTED)
+* @param entries2[IN] the # leaf entries under pid2 (NODE_LAYOUT_COUNTED)
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2, int entries1, int entries2)
 {
-    if(pid1<0 || pid2<0)
-        return RC_INVALID_PID;
+	if(pid1<0 || pid2<0)
+		return RC_INVALID_PID;
 	
-	memcpy(buffer, &pid1, sizeof(PageId));
-	memcpy(buffer + sizeof(PageId), &key, sizeof(PageId));
-	memcpy(buffer + keyPageComponentSize, &pid2, sizeof(PageId));
+	makeWritable();
+	memcpy(buffer + pidOffset(0), &pid1, sizeof(PageId));
+	memcpy(buffer + keyOffset(0), &key, sizeof(int));
+	memcpy(buffer + pidOffset(1), &pid2, sizeof(PageId));
+	if(layout == NODE_LAYOUT_COUNTED){
+		memcpy(buffer + sizeOffset(0), &entries1, sizeof(int));
+		memcpy(buffer + sizeOffset(1), &entries2, sizeof(int));
+	}
 	
 	//set tupleCount to 1
 	tupleCount = 1;
 	
 	return 0;
 }
+
+/*
+* Return the i'th child-node pointer of the node.
+* @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+* @return the PageId of the child node. RC_INVALID_PID if i is out of range
+*/
+PageId BTNonLeafNode::getChildPtr(int i)
+{
+	if(i < 0 || i > tupleCount)
+		return RC_INVALID_PID;
+	PageId pid;
+	memcpy(&pid, page + pidOffset(i), sizeof(PageId));
+	return pid;
+}
+
+/*
+* Return the # leaf entries under the i'th child-node pointer.
+* @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+* @return the # entries. RC_INVALID_FILE_FORMAT if the layout keeps no counts,
+*         RC_INVALID_PID if i is out of range
+*/
+int BTNonLeafNode::getSubtreeSize(int i)
+{
+	if(layout != NODE_LAYOUT_COUNTED)
+		return RC_INVALID_FILE_FORMAT;
+	if(i < 0 || i > tupleCount)
+		return RC_INVALID_PID;
+	int entries;
+	memcpy(&entries, page + sizeOffset(i), sizeof(int));
+	return entries;
+}
+
+/*
+* Set the # leaf entries under the i'th child-node pointer.
+* @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+* @param entries[IN] the # entries
+* @return 0 if successful. RC_INVALID_FILE_FORMAT if the layout keeps no counts,
+*         RC_INVALID_PID if i is out of range
+*/
+RC BTNonLeafNode::setSubtreeSize(int i, int entries)
+{
+	if(layout != NODE_LAYOUT_COUNTED)
+		return RC_INVALID_FILE_FORMAT;
+	if(i < 0 || i > tupleCount)
+		return RC_INVALID_PID;
+	makeWritable();
+	memcpy(buffer + sizeOffset(i), &entries, sizeof(int));
+	return 0;
+}
+
+/*
+* Return the # leaf entries under the node.
+* @return the # entries. RC_INVALID_FILE_FORMAT if the layout keeps no counts
+*/
+int BTNonLeafNode::getTotalSize()
+{
+	if(layout != NODE_LAYOUT_COUNTED)
+		return RC_INVALID_FILE_FORMAT;
+	int total = 0;
+	for(int i = 0; i <= tupleCount; i++){
+		int entries;
+		memcpy(&entries, page + sizeOffset(i), sizeof(int));
+		total += entries;
+	}
+	return total;
+}
+
+/*
+* Return the on-page layout of the node entries.
+* @return NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+*/
+int BTNonLeafNode::getLayout()
+{
+	return layout;
+}
+
+/*
+* Rearrange the entries of the node into another on-page layout.
+* The entry counts of NODE_LAYOUT_COUNTED start out 0.
+* @param newLayout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTNonLeafNode::setLayout(int newLayout)
+{
+	if(!isNodeLayout(newLayout))
+		return RC_INVALID_FILE_FORMAT;
+	makeWritable();
+	if(newLayout == layout)
+		return 0;
+	//The layouts hold different # keys in a page
+	int newMaxKeys = nonLeafCapacity(pageSize, newLayout);
+	if(tupleCount > newMaxKeys)
+		return RC_NODE_FULL;
+	
+	//Copy the entries out of the old layout, the key count stays where it is
+	char old[PageFile::MAX_PAGE_SIZE];
+	int oldLayout = layout;
+	int oldMaxKeys = maxKeys;
+	memcpy(old, buffer, pageSize);
+	memset(buffer, 0, pageSize - sizeof(int));
+	layout = newLayout;
+	maxKeys = newMaxKeys;
+	for(int i = 0; i < tupleCount; i++)
+		memcpy(buffer + keyOffset(i), old + nonLeafKeyOffset(oldLayout, i), sizeof(int));
+	for(int i = 0; i <= tupleCount; i++)
+		memcpy(buffer + pidOffset(i), old + nonLeafPidOffset(oldLayout, oldMaxKeys, i), sizeof(PageId));
+	return 0;
+}
+
+int BTNonLeafNode::keyOffset(int eid)
+{
+	return nonLeafKeyOffset(layout, eid);
+}
+
+int BTNonLeafNode::pidOffset(int eid)
+{
+	return nonLeafPidOffset(layout, maxKeys, eid);
+}
+
+int BTNonLeafNode::sizeOffset(int eid)
+{
+	return nonLeafSizeOffset(maxKeys, eid);
+}
+
+int BTNonLeafNode::keyStride()
+{
+	return (layout != NODE_LAYOUT_INTERLEAVED) ? sizeof(int) : keyPageComponentSize;
+}
+
+/*
+* Insert key as key number eid and pid as the pointer right of it,
+* shifting the keys and pointers after them by one.
+* entries is the # leaf entries under pid, kept by NODE_LAYOUT_COUNTED.
+*/
+void BTNonLeafNode::insertEntry(int eid, int key, PageId pid, int entries)
+{
+	int shifted = tupleCount - eid;
+	if(layout == NODE_LAYOUT_COUNTED){
+		memmove(buffer + sizeOffset(eid+2), buffer + sizeOffset(eid+1), shifted*sizeof(int));
+		memcpy(buffer + sizeOffset(eid+1), &entries, sizeof(int));
+	}
+	if(layout != NODE_LAYOUT_INTERLEAVED){
+		memmove(buffer + keyOffset(eid+1), buffer + keyOffset(eid), shifted*sizeof(int));
+		memmove(buffer + pidOffset(eid+2), buffer + pidOffset(eid+1), shifted*sizeof(PageId));
+	}else{
+		//key eid and the pointer after it are adjacent
+		memmove(buffer + keyOffset(eid+1), buffer + keyOffset(eid), shifted*keyPageComponentSize);
+	}
+	memcpy(buffer + keyOffset(eid), &key, sizeof(int));
+	memcpy(buffer + pidOffset(eid+1), &pid, sizeof(PageId));
+	tupleCount++;
+}
@@ -14,18 +14,74 @@
 #include "PageFile.h"
 
 //Max to fulfill test cases, MAKE sure that space for an extra record is allowed for insertsplit
+//Nodes in pages larger than 1KB hold as many entries as fit (see leafCapacity and nonLeafCapacity)
 const int MAX_LEAF_RECORDS = 60;
 //Size of variables inserted into buffer
 const int keyPageComponentSize = (sizeof(PageId) + sizeof(int)); //basic size of PageId + int
 const int keyRecordComponentSize = (sizeof(RecordId) + sizeof(int));
 
+//Max # keys of a leaf node in a page of pageSize bytes.
+//The last 8 bytes of a page hold the next node ptr and the key count
+inline int leafCapacity(int pageSize)
+{
+	if(pageSize <= PageFile::PAGE_SIZE)
+		return MAX_LEAF_RECORDS;
+	return (pageSize - 2*sizeof(int)) / keyRecordComponentSize - 1;
+}
+
+//On-page layouts of the node entries. NODE_LAYOUT_INTERLEAVED keeps each key next to
+//its RecordId or PageId. NODE_LAYOUT_SOA keeps all keys of a node in one array in front
+//of the RecordIds or PageIds, so a key search touches fewer cache lines.
+//NODE_LAYOUT_COUNTED is NODE_LAYOUT_SOA with the # leaf entries under each child
+//pointer of a nonleaf node stored after the PageIds, so ranges are counted from the upper levels
+const int NODE_LAYOUT_INTERLEAVED = 0;
+const int NODE_LAYOUT_SOA = 1;
+const int NODE_LAYOUT_COUNTED = 2;
+
+inline bool isNodeLayout(int layout)
+{
+	return layout >= NODE_LAYOUT_INTERLEAVED && layout <= NODE_LAYOUT_COUNTED;
+}
+
+//Max # keys of a nonleaf node in a page of pageSize bytes.
+//One extra (key, pid) pair must fit while the node is split
+inline int nonLeafCapacity(int pageSize, int layout = NODE_LAYOUT_INTERLEAVED)
+{
+	if(pageSize <= PageFile::PAGE_SIZE)
+		return MAX_LEAF_RECORDS;
+	//NODE_LAYOUT_COUNTED keeps an entry count next to each pid
+	if(layout == NODE_LAYOUT_COUNTED)
+		return (pageSize - 3*sizeof(int)) / (keyPageComponentSize + sizeof(int)) - 1;
+	return (pageSize - 2*sizeof(int)) / keyPageComponentSize - 1;
+}
+
+//# keys left after the binary search that are compared all at once
+const int SEARCH_BLOCK_KEYS = 8;
+
+/**
+ * Count the keys smaller than searchKey among n sorted keys, the first of
+ * which is at keys and the following ones stride bytes apart.
+ * This is the position of the first key >= searchKey.
+ * A branch-free binary search narrows the range down to SEARCH_BLOCK_KEYS
+ * keys, which are compared with a single vector compare (AVX2 or SSE2).
+ * @param keys[IN] pointer to the first key
+ * @param stride[IN] distance between two keys in bytes
+ * @param n[IN] the number of keys
+ * @param searchKey[IN] the key to search for
+ * @return the number of keys smaller than searchKey
+ */
+int countKeysLess(const char* keys, int stride, int n, int searchKey);
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
  */
 class BTLeafNode {
   public:
-    //Constructor
-	BTLeafNode();
+    //Constructor. pageSize is the page size of the file the node is written to,
+    //layout the on-page layout of the index the node belongs to (NODE_LAYOUT_*)
+	BTLeafNode(int pageSize = PageFile::PAGE_SIZE, int layout = NODE_LAYOUT_INTERLEAVED);
+	//Destructor, releases the pinned page if there is one
+	~BTLeafNode();
 	
    /**
     * Insert the (key, rid) pair to the node.
@@ -36,6 +92,15 @@ class BTLeafNode {
     */
     RC insert(int key, const RecordId& rid);
 
+   /**
+    * Append the (key, rid) pair after the last entry of the node.
+    * This builds a node from entries that are already sorted.
+    * @param key[IN] the key to append. It must not be smaller than the last key
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, const RecordId& rid);
+
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
@@ -55,7 +120,8 @@ class BTLeafNode {
     * Remember that keys inside a B+tree node are sorted.
     * @param searchKey[IN] the key to search for.
     * @param eid[OUT] the entry number that contains a key larger              
-    *                 than or equalty to searchKey.
+    *                 than or equalty to searchKey. getKeyCount() if
+    *                 every key in the node is smaller than searchKey.
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC locate(int searchKey, int& eid);
@@ -88,6 +154,26 @@ class BTLeafNode {
     * @return the number of keys in the node
     */
     int getKeyCount();
+
+   /**
+    * Return the number of keys the node can hold before it has to be split.
+    * @return the maximum number of keys in the node
+    */
+    int getMaxKeyCount();
+
+   /**
+    * Return the on-page layout of the node entries.
+    * @return NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+    */
+    int getLayout();
+
+   /**
+    * Rearrange the entries of the node into another on-page layout.
+    * The node has to be written for the change to reach the disk.
+    * @param newLayout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setLayout(int newLayout);
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
@@ -97,6 +183,22 @@ class BTLeafNode {
     */
     RC read(PageId pid, const PageFile& pf);
     
+   /**
+    * Pin the page pid in the PageFile pf and use the cached page as the
+    * content of the node without copying it into the node buffer.
+    * The page stays pinned until unpin(), read() or the node is destroyed.
+    * Modifying a pinned node copies the page into the node buffer first.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(), if any.
+    */
+    void unpin();
+    
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -110,8 +212,34 @@ class BTLeafNode {
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char buffer[PageFile::MAX_PAGE_SIZE];
 	int tupleCount;
+	//The page size of the node and the max # keys that fit in it
+	int pageSize;
+	int maxKeys;
+	//The on-page layout of the entries. read() and pin() keep it
+	int layout;
+	//The content of the node. Points to buffer or to a pinned cache page
+	const char* page;
+	//The PageFile that page is pinned in. NULL if nothing is pinned
+	const PageFile* pinnedFile;
+
+	//Copy a pinned page into buffer so that the node can be modified
+	void makeWritable();
+
+	//Offsets of the key and the RecordId of entry eid in the page
+	int keyOffset(int eid);
+	int ridOffset(int eid);
+	//Distance between two keys in bytes
+	int keyStride();
+	//Move n entries starting at entry from so that they start at entry to
+	void moveEntries(int from, int to, int n);
+	//Zero n entries starting at entry from
+	void clearEntries(int from, int n);
+
+	//Nodes own their pins and cannot be copied
+	BTLeafNode(const BTLeafNode&);
+	BTLeafNode& operator=(const BTLeafNode&);
 }; 
 
 
@@ -121,17 +249,34 @@ class BTLeafNode {
 class BTNonLeafNode {
 
   public:
-    //Constructor
-	BTNonLeafNode();
+    //Constructor. pageSize is the page size of the file the node is written to,
+    //layout the on-page layout of the index the node belongs to (NODE_LAYOUT_*)
+	BTNonLeafNode(int pageSize = PageFile::PAGE_SIZE, int layout = NODE_LAYOUT_INTERLEAVED);
+	//Destructor, releases the pinned page if there is one
+	~BTNonLeafNode();
 	
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+    * @param child[IN] the pointer number of the child that pid was split from,
+    *                  so the pair goes right of it. -1 places the pair by key,
+    *                  which is ambiguous among equal keys
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, int entries = 0, int child = -1);
+
+   /**
+    * Append the (key, pid) pair after the last key of the node.
+    * This builds a node from entries that are already sorted.
+    * @param key[IN] the key to append. It must not be smaller than the last key
+    * @param pid[IN] the PageId to append right of the key
+    * @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, PageId pid, int entries = 0);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -143,13 +288,17 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param entries[IN] the # leaf entries under pid (NODE_LAYOUT_COUNTED)
+    * @param child[IN] the pointer number of the child that pid was split from, as in insert()
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int entries = 0, int child = -1);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
-    * output it in pid.
+    * output it in pid. Keys are not unique, so a key equal to a separator
+    * key can be on both sides of it. This is the leftmost child that can
+    * hold searchKey; the leaves right of it are reached by their next pointers.
     * Remember that the keys inside a B+tree node are sorted.
     * @param searchKey[IN] the searchKey that is being looked up.
     * @param pid[OUT] the pointer to the child node to follow.
@@ -157,14 +306,26 @@ class BTNonLeafNode {
     */
     RC locateChildPtr(int searchKey, PageId& pid);
 
+   /**
+    * Same as locateChildPtr(searchKey, pid), and also output the
+    * number of the pointer, as used by getChildPtr().
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param pid[OUT] the pointer to the child node to follow.
+    * @param i[OUT] the pointer number of pid
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateChildPtr(int searchKey, PageId& pid, int& i);
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
     * @param key[IN] the key that should be inserted between the two PageIds
     * @param pid2[IN] the PageId to insert behind the key
+    * @param entries1[IN] the # leaf entries under pid1 (NODE_LAYOUT_COUNTED)
+    * @param entries2[IN] the # leaf entries under pid2 (NODE_LAYOUT_COUNTED)
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initializeRoot(PageId pid1, int key, PageId pid2, int entries1 = 0, int entries2 = 0);
 
    /**
     * Return the number of keys stored in the node.
@@ -172,6 +333,12 @@ class BTNonLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the number of keys the node can hold before it has to be split.
+    * @return the maximum number of keys in the node
+    */
+    int getMaxKeyCount();
+
    /**
 	* Change the counter stating the number of keys stored in a node.
 	* @update tupleCount
@@ -183,7 +350,55 @@ class BTNonLeafNode {
 	* @return the pointer to the node's buffer
 	*/
     char* getBufferPointer();	
+
+   /**
+    * Return the i'th child-node pointer of the node.
+    * @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+    * @return the PageId of the child node. RC_INVALID_PID if i is out of range
+    */
+    PageId getChildPtr(int i);
+
+   /**
+    * Return the # leaf entries under the i'th child-node pointer.
+    * Only NODE_LAYOUT_COUNTED keeps them.
+    * @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+    * @return the # entries. RC_INVALID_FILE_FORMAT if the layout keeps no counts,
+    *         RC_INVALID_PID if i is out of range
+    */
+    int getSubtreeSize(int i);
+
+   /**
+    * Set the # leaf entries under the i'th child-node pointer.
+    * @param i[IN] the pointer number, 0 <= i <= getKeyCount()
+    * @param entries[IN] the # entries
+    * @return 0 if successful. RC_INVALID_FILE_FORMAT if the layout keeps no counts,
+    *         RC_INVALID_PID if i is out of range
+    */
+    RC setSubtreeSize(int i, int entries);
+
+   /**
+    * Return the # leaf entries under the node, the sum of the counts of
+    * its child pointers. Only NODE_LAYOUT_COUNTED keeps them.
+    * @return the # entries. RC_INVALID_FILE_FORMAT if the layout keeps no counts
+    */
+    int getTotalSize();
 	
+   /**
+    * Return the on-page layout of the node entries.
+    * @return NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+    */
+    int getLayout();
+
+   /**
+    * Rearrange the entries of the node into another on-page layout.
+    * The node has to be written for the change to reach the disk.
+    * The entry counts of NODE_LAYOUT_COUNTED start out 0 and have to be set.
+    * @param newLayout[IN] NODE_LAYOUT_INTERLEAVED, NODE_LAYOUT_SOA or NODE_LAYOUT_COUNTED
+    * @return 0 if successful. Return an error code if there is an error,
+    *         RC_NODE_FULL if the keys do not fit in the new layout.
+    */
+    RC setLayout(int newLayout);
+ 
    /**
     * Read the content of the node from the page pid in the PageFile pf.
     * @param pid[IN] the PageId to read
@@ -192,6 +407,31 @@ class BTNonLeafNode {
     */
     RC read(PageId pid, const PageFile& pf);
     
+   /**
+    * Pin the page pid in the PageFile pf and use the cached page as the
+    * content of the node without copying it into the node buffer.
+    * The page stays pinned until unpin(), read() or the node is destroyed.
+    * Modifying a pinned node copies the page into the node buffer first.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to pin the page from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Release the page pinned by pin(), if any.
+    */
+    void unpin();
+
+   /**
+    * Use a copy of the node kept in memory by the caller as the content
+    * of the node, like pin() without the PageFile. The copy must stay
+    * unchanged until unpin(), read(), pin() or the node is destroyed.
+    * Modifying the node copies the page into the node buffer first.
+    * @param content[IN] the page of the node, of the node's page size
+    */
+    void view(const char* content);
+    
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -205,8 +445,33 @@ class BTNonLeafNode {
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char buffer[PageFile::MAX_PAGE_SIZE];
 	int tupleCount;
+	//The page size of the node and the max # keys that fit in it
+	int pageSize;
+	int maxKeys;
+	//The on-page layout of the entries. read() and pin() keep it
+	int layout;
+	//The content of the node. Points to buffer, to a pinned cache page or to a viewed copy
+	const char* page;
+	//The PageFile that page is pinned in. NULL if nothing is pinned
+	const PageFile* pinnedFile;
+
+	//Copy a pinned page into buffer so that the node can be modified
+	void makeWritable();
+
+	//Offsets of key eid, of child pointer eid and of its entry count in the page
+	int keyOffset(int eid);
+	int pidOffset(int eid);
+	int sizeOffset(int eid);
+	//Distance between two keys in bytes
+	int keyStride();
+	//Insert key as key eid and pid as the pointer right of it
+	void insertEntry(int eid, int key, PageId pid, int entries);
+
+	//Nodes own their pins and cannot be copied
+	BTNonLeafNode(const BTNonLeafNode&);
+	BTNonLeafNode& operator=(const BTNonLeafNode&);
 }; 
 
 #endif /* BTNODE_H */
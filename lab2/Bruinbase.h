@@ -32,5 +32,11 @@ const int RC_NODE_NOT_FULL			 = -1017;
 const int RC_SIB_NOT_EMPTY 			 = -1018;
 const int RC_TREE_EMPTY 				 = -1019;
 const int RC_CONDITION_CONFLICT  = -1020;
+const int RC_INVALID_CACHE_SIZE  = -1021;
+const int RC_BUFFER_FULL         = -1022;
+const int RC_INVALID_PAGE_SIZE   = -1023;
+const int RC_INVALID_FILL_FACTOR = -1024;
+const int RC_INVALID_THREAD_COUNT = -1025;
+const int RC_INVALID_POLICY      = -1026;
 
 #endif // BRUINBASE_H
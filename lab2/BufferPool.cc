@@ -0,0 +1,772 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include "Bruinbase.h"
+#include "BufferPool.h"
+#include "PageFile.h"
+
+// holds a shard mutex for the lifetime of the object
+class BufferPool::Lock {
+ public:
+  Lock(pthread_mutex_t& m) : mutex(m) { pthread_mutex_lock(&mutex); }
+  ~Lock() { pthread_mutex_unlock(&mutex); }
+ private:
+  pthread_mutex_t& mutex;
+};
+
+BufferPool::BufferPool(int count, int size)
+{
+  frameSize = size;
+  policy = DEFAULT_POLICY;
+  for (int p = 0; p < POLICY_COUNT; p++) policyHits[p] = policyMisses[p] = 0;
+  init(count);
+}
+
+BufferPool::~BufferPool()
+{
+  flushAll();
+  destroy();
+}
+
+RC BufferPool::resize(int count)
+{
+  if (count <= 0) return RC_INVALID_CACHE_SIZE;
+  return rebuild(count, frameSize, policy);
+}
+
+RC BufferPool::resize(int count, int size)
+{
+  if (count <= 0) return RC_INVALID_CACHE_SIZE;
+  if (size <= 0) return RC_INVALID_PAGE_SIZE;
+  return rebuild(count, size, policy);
+}
+
+RC BufferPool::setPolicy(Policy newPolicy)
+{
+  if (newPolicy < 0 || newPolicy >= POLICY_COUNT) return RC_INVALID_POLICY;
+  return rebuild(frameCount, frameSize, newPolicy);
+}
+
+const char* BufferPool::policyName(Policy p)
+{
+  switch (p) {
+  case LRU:   return "lru";
+  case CLOCK: return "clock";
+  case TWO_Q: return "2q";
+  }
+  return "?";
+}
+
+RC BufferPool::rebuild(int count, int size, Policy newPolicy)
+{
+  RC rc;
+
+  lockAll();
+
+  // pinned pages must stay where they are
+  for (int f = 0; f < frameCount; f++) {
+    if (frames[f].pinCount > 0) {
+      unlockAll();
+      return RC_BUFFER_FULL;
+    }
+  }
+
+  // the dirty pages must reach the disk before the frames go away
+  rc = flushDirty(-1);
+  unlockAll();
+  if (rc < 0) return rc;
+
+  // the statistics of the shards are kept with the policy they were made under
+  policyHits[policy] = getHitCount(policy);
+  policyMisses[policy] = getMissCount(policy);
+
+  destroy();
+  policy = newPolicy;
+  frameSize = size;
+  init(count);
+
+  return 0;
+}
+
+void BufferPool::init(int count)
+{
+  frameCount = count;
+  frames = new Frame[frameCount];
+  data = (char*) malloc((size_t) frameCount * frameSize);
+
+  // a small pool is a single shard, so that pages do not compete for
+  // a few frames of their shard while other shards have frames to spare
+  shardCount = frameCount / MIN_SHARD_FRAMES;
+  if (shardCount > MAX_SHARDS) shardCount = MAX_SHARDS;
+  if (shardCount < 1) shardCount = 1;
+  shardFrames = frameCount / shardCount;
+  shards = new Shard[shardCount];
+
+  for (int i = 0; i < shardCount; i++) {
+    Shard& s = shards[i];
+    s.first = i * shardFrames;
+    s.count = (i + 1 < shardCount) ? shardFrames : frameCount - s.first;
+
+    // keep the load factor of the hash table at or below 1/2
+    s.bucketCount = 1;
+    while (s.bucketCount < 2 * s.count) s.bucketCount <<= 1;
+    s.buckets = new int[s.bucketCount];
+    for (int b = 0; b < s.bucketCount; b++) s.buckets[b] = -1;
+
+    // every frame starts in the free list of its shard
+    for (int f = s.first; f < s.first + s.count; f++) {
+      frames[f].owner = NULL;
+      frames[f].fid = -1;
+      frames[f].pid = -1;
+      frames[f].dirty = false;
+      frames[f].pinCount = 0;
+      frames[f].loading = false;
+      frames[f].writing = false;
+      frames[f].referenced = false;
+      frames[f].once = false;
+      frames[f].hashNext = -1;
+      frames[f].prev = -1;
+      frames[f].next = (f + 1 < s.first + s.count) ? f + 1 : -1;
+    }
+    s.freeFrame = s.first;
+    s.mruFrame = s.lruFrame = -1;
+    s.clockHand = 0;
+    s.lastFound = -1;
+
+    // 2Q remembers up to half as many pages as the shard holds
+    s.newFrame = s.oldFrame = -1;
+    s.onceCount = 0;
+    s.ghostCount = 0;
+    s.ghostOldest = 0;
+    s.ghostSlots = (s.count / 2 > 0) ? s.count / 2 : 1;
+    s.ghostBuckets = 1;
+    while (s.ghostBuckets < 2 * s.ghostSlots) s.ghostBuckets <<= 1;
+    s.ghostFid = new int[s.ghostSlots];
+    s.ghostPid = new PageId[s.ghostSlots];
+    s.ghostNext = new int[s.ghostSlots];
+    s.ghostHash = new int[s.ghostBuckets];
+    for (int b = 0; b < s.ghostBuckets; b++) s.ghostHash[b] = -1;
+
+    s.hitCount = 0;
+    s.missCount = 0;
+    pthread_mutex_init(&s.mutex, NULL);
+    pthread_cond_init(&s.filled, NULL);
+  }
+}
+
+void BufferPool::destroy()
+{
+  for (int i = 0; i < shardCount; i++) {
+    delete [] shards[i].buckets;
+    delete [] shards[i].ghostFid;
+    delete [] shards[i].ghostPid;
+    delete [] shards[i].ghostNext;
+    delete [] shards[i].ghostHash;
+    pthread_cond_destroy(&shards[i].filled);
+    pthread_mutex_destroy(&shards[i].mutex);
+  }
+  delete [] shards;
+  delete [] frames;
+  free(data);
+}
+
+void BufferPool::lockAll() const
+{
+  // always in the same order, so that two callers cannot deadlock
+  for (int i = 0; i < shardCount; i++) pthread_mutex_lock(&shards[i].mutex);
+}
+
+void BufferPool::unlockAll() const
+{
+  for (int i = shardCount - 1; i >= 0; i--) pthread_mutex_unlock(&shards[i].mutex);
+}
+
+unsigned BufferPool::hashOf(int fid, PageId pid) const
+{
+  return (unsigned) pid * 2654435761u ^ (unsigned) fid * 40503u;
+}
+
+BufferPool::Shard& BufferPool::shardOf(int fid, PageId pid) const
+{
+  // the high bits pick the shard, the low bits the bucket within it.
+  // consecutive pages of a file land in different shards
+  return shards[(hashOf(fid, pid) >> 16) % shardCount];
+}
+
+BufferPool::Shard& BufferPool::shardOfFrame(int f) const
+{
+  int i = f / shardFrames;
+  return shards[(i < shardCount) ? i : shardCount - 1];
+}
+
+int BufferPool::find(const Shard& s, int fid, PageId pid) const
+{
+  int b = (int) (hashOf(fid, pid) & (s.bucketCount - 1));
+  for (int f = s.buckets[b]; f >= 0; f = frames[f].hashNext) {
+    if (frames[f].fid == fid && frames[f].pid == pid) return f;
+  }
+  return -1;
+}
+
+int BufferPool::findFilled(Shard& s, int fid, PageId pid)
+{
+  int f;
+
+  // a frame being filled by another thread is waited for.
+  // the page is looked up again, since it may be dropped in the meantime
+  while ((f = find(s, fid, pid)) >= 0 && frames[f].loading) {
+    pthread_cond_wait(&s.filled, &s.mutex);
+  }
+  return f;
+}
+
+int BufferPool::frameOf(const char* buffer) const
+{
+  return (int) ((buffer - data) / frameSize);
+}
+
+void BufferPool::unlink(int& head, int& tail, int f)
+{
+  if (frames[f].prev >= 0) frames[frames[f].prev].next = frames[f].next;
+  else head = frames[f].next;
+  if (frames[f].next >= 0) frames[frames[f].next].prev = frames[f].prev;
+  else tail = frames[f].prev;
+  frames[f].prev = frames[f].next = -1;
+}
+
+void BufferPool::pushFront(int& head, int& tail, int f)
+{
+  frames[f].prev = -1;
+  frames[f].next = head;
+  if (head >= 0) frames[head].prev = f;
+  head = f;
+  if (tail < 0) tail = f;
+}
+
+void BufferPool::pushBack(int& head, int& tail, int f)
+{
+  frames[f].next = -1;
+  frames[f].prev = tail;
+  if (tail >= 0) frames[tail].next = f;
+  tail = f;
+  if (head < 0) head = f;
+}
+
+//
+// the replacement policies see a page enter the shard, get pinned and
+// unpinned, and leave it. only unpinned pages are chosen as victims
+//
+
+void BufferPool::pinned(Shard& s, int f)
+{
+  // a pinned frame leaves the LRU list so that it cannot be chosen as victim.
+  // a 2Q frame keeps its place in the FIFO queue
+  if (policy == LRU || (policy == TWO_Q && !frames[f].once)) {
+    unlink(s.mruFrame, s.lruFrame, f);
+  }
+}
+
+void BufferPool::unpinned(Shard& s, int f)
+{
+  if (policy == CLOCK) frames[f].referenced = true;
+  else if (!frames[f].once) pushFront(s.mruFrame, s.lruFrame, f);
+}
+
+void BufferPool::enter(Shard& s, int f)
+{
+  frames[f].referenced = false;
+  frames[f].once = false;
+
+  // a 2Q page enters the FIFO queue unless it is read again
+  // soon after it left the queue
+  if (policy == TWO_Q && !ghostRemove(s, frames[f].fid, frames[f].pid)) {
+    frames[f].once = true;
+    pushFront(s.newFrame, s.oldFrame, f);
+    s.onceCount++;
+  }
+}
+
+void BufferPool::leave(Shard& s, int f)
+{
+  if (s.lastFound == f) s.lastFound = -1;
+  if (frames[f].once) {
+    unlink(s.newFrame, s.oldFrame, f);
+    s.onceCount--;
+    frames[f].once = false;
+  } else if (policy != CLOCK && frames[f].pinCount == 0) {
+    unlink(s.mruFrame, s.lruFrame, f);
+  }
+}
+
+int BufferPool::victim(Shard& s)
+{
+  int f;
+
+  switch (policy) {
+  case CLOCK:
+    // give each used page a second chance. after two rounds every
+    // unpinned page has been found unused
+    for (int n = 0; n < 2 * s.count; n++) {
+      f = s.first + s.clockHand;
+      s.clockHand = (s.clockHand + 1) % s.count;
+      if (frames[f].fid < 0 || frames[f].pinCount > 0) continue;
+      if (!frames[f].referenced) return f;
+      frames[f].referenced = false;
+    }
+    return -1;
+
+  case TWO_Q:
+    // the oldest unpinned page of the FIFO queue goes first once the queue
+    // holds more than its share, or when the LRU queue has nothing to give
+    if (s.onceCount > s.count / 4 || s.lruFrame < 0) {
+      for (f = s.oldFrame; f >= 0; f = frames[f].prev) {
+        if (frames[f].pinCount == 0) return f;
+      }
+    }
+    return s.lruFrame;
+
+  default:
+    return s.lruFrame;
+  }
+}
+
+bool BufferPool::ghostRemove(Shard& s, int fid, PageId pid)
+{
+  int* link = &s.ghostHash[hashOf(fid, pid) & (s.ghostBuckets - 1)];
+
+  for (; *link >= 0; link = &s.ghostNext[*link]) {
+    int g = *link;
+    if (s.ghostFid[g] == fid && s.ghostPid[g] == pid) {
+      // the slot stays in the ring until it is the oldest
+      *link = s.ghostNext[g];
+      s.ghostFid[g] = -1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void BufferPool::ghostAdd(Shard& s, int fid, PageId pid)
+{
+  int g;
+
+  // forget the oldest page if the ring is full
+  if (s.ghostCount == s.ghostSlots) {
+    g = s.ghostOldest;
+    if (s.ghostFid[g] >= 0) ghostRemove(s, s.ghostFid[g], s.ghostPid[g]);
+    s.ghostOldest = (s.ghostOldest + 1) % s.ghostSlots;
+    s.ghostCount--;
+  }
+
+  g = (s.ghostOldest + s.ghostCount++) % s.ghostSlots;
+  int b = (int) (hashOf(fid, pid) & (s.ghostBuckets - 1));
+  s.ghostFid[g] = fid;
+  s.ghostPid[g] = pid;
+  s.ghostNext[g] = s.ghostHash[b];
+  s.ghostHash[b] = g;
+}
+
+void BufferPool::hashRemove(Shard& s, int f)
+{
+  int* link = &s.buckets[hashOf(frames[f].fid, frames[f].pid) & (s.bucketCount - 1)];
+  while (*link != f) link = &frames[*link].hashNext;
+  *link = frames[f].hashNext;
+  frames[f].hashNext = -1;
+}
+
+void BufferPool::release(Shard& s, int f)
+{
+  // take the frame out of the hash table and the replacement lists
+  // and put it back to the free list
+  markFilled(s, f);
+  hashRemove(s, f);
+  leave(s, f);
+  frames[f].owner = NULL;
+  frames[f].fid = -1;
+  frames[f].pid = -1;
+  frames[f].dirty = false;
+  frames[f].pinCount = 0;
+  frames[f].prev = -1;
+  frames[f].next = s.freeFrame;
+  s.freeFrame = f;
+}
+
+void BufferPool::markFilled(Shard& s, int f)
+{
+  if (frames[f].loading) {
+    frames[f].loading = false;
+    pthread_cond_broadcast(&s.filled);
+  }
+}
+
+char* BufferPool::lookup(int fid, PageId pid)
+{
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+
+  int f = findFilled(s, fid, pid);
+  if (f < 0) {
+    s.missCount++;
+    return NULL;
+  }
+
+  // the frame is handed out pinned, so it leaves the LRU list
+  s.hitCount++;
+  if (frames[f].pinCount++ == 0) pinned(s, f);
+
+  // a 2Q page used twice while in the FIFO queue moves to the LRU queue
+  // when it is unpinned. finding the page found last in the shard again,
+  // like a scan reading a page one record at a time, is not another use
+  if (frames[f].once && f != s.lastFound) {
+    if (frames[f].referenced) {
+      unlink(s.newFrame, s.oldFrame, f);
+      s.onceCount--;
+      frames[f].once = false;
+    } else {
+      frames[f].referenced = true;
+    }
+  }
+  s.lastFound = f;
+  return data + (size_t) f * frameSize;
+}
+
+bool BufferPool::contains(int fid, PageId pid) const
+{
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+  return find(s, fid, pid) >= 0;
+}
+
+RC BufferPool::take(Shard& s, const PageFile* owner, int fid, PageId pid, int& f)
+{
+  RC rc;
+
+  if (s.freeFrame >= 0) {
+    // take a frame from the free list
+    f = s.freeFrame;
+    s.freeFrame = frames[f].next;
+  } else {
+    // evict the page chosen by the policy.
+    // a dirty page has to be written to the disk first. the shard is
+    // not held meanwhile, so the caller looks the page up again
+    if ((f = victim(s)) < 0) return RC_BUFFER_FULL;
+    if (frames[f].dirty) {
+      rc = writeBack(s, f);
+      f = -1;
+      return rc;
+    }
+    if (frames[f].once) ghostAdd(s, frames[f].fid, frames[f].pid);
+    hashRemove(s, f);
+    leave(s, f);
+  }
+
+  // register the frame in the hash table
+  int b = (int) (hashOf(fid, pid) & (s.bucketCount - 1));
+  frames[f].owner = owner;
+  frames[f].fid = fid;
+  frames[f].pid = pid;
+  frames[f].dirty = false;
+  frames[f].pinCount = 0;
+  frames[f].loading = false;
+  frames[f].hashNext = s.buckets[b];
+  s.buckets[b] = f;
+  enter(s, f);
+
+  return 0;
+}
+
+RC BufferPool::allocate(const PageFile* owner, int fid, PageId pid, bool dirty, char*& buffer)
+{
+  RC  rc;
+  int f;
+
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+
+  // take() gives no frame when it wrote a dirty victim, since the page
+  // may have been cached by another thread in the meantime
+  do {
+    if ((f = findFilled(s, fid, pid)) >= 0) {
+      // the page is already cached. just reuse its frame.
+      // the frame is handed out pinned, so it leaves the LRU list
+      if (frames[f].pinCount == 0) pinned(s, f);
+    } else if ((rc = take(s, owner, fid, pid, f)) < 0) {
+      return rc;
+    } else if (f >= 0) {
+      // other threads wait for the page until the caller has filled the frame
+      frames[f].loading = true;
+    }
+  } while (f < 0);
+
+  if (dirty) frames[f].dirty = true;
+
+  frames[f].pinCount++;
+  buffer = data + (size_t) f * frameSize;
+  return 0;
+}
+
+RC BufferPool::allocateNew(const PageFile* owner, int fid, PageId pid, char*& buffer)
+{
+  RC  rc;
+  int f;
+
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+
+  buffer = NULL;
+  do {
+    // a page cached by another thread, or on its way in, is left alone
+    if (find(s, fid, pid) >= 0) return 0;
+    if ((rc = take(s, owner, fid, pid, f)) < 0) return rc;
+  } while (f < 0);
+
+  // other threads wait for the page until the caller has filled the frame
+  frames[f].loading = true;
+  frames[f].pinCount++;
+  buffer = data + (size_t) f * frameSize;
+  return 0;
+}
+
+RC BufferPool::install(const PageFile* owner, int fid, PageId pid, const char* page)
+{
+  int f;
+
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+
+  do {
+    // a cached copy may be newer than the given one
+    if (find(s, fid, pid) >= 0) return 0;
+
+    // read-ahead is only a hint. give up if there is no frame to spare
+    if (take(s, owner, fid, pid, f) < 0) return 0;
+  } while (f < 0);
+
+  // the copy is made under the lock, so no reader sees a partial page
+  memcpy(data + (size_t) f * frameSize, page, owner->pageSize());
+  unpinned(s, f);
+  return 0;
+}
+
+void BufferPool::pin(const char* buffer)
+{
+  int f = frameOf(buffer);
+  Shard& s = shardOfFrame(f);
+  Lock lock(s.mutex);
+
+  if (frames[f].pinCount++ == 0) pinned(s, f);
+}
+
+void BufferPool::unpin(const char* buffer)
+{
+  int f = frameOf(buffer);
+  Shard& s = shardOfFrame(f);
+  Lock lock(s.mutex);
+
+  markFilled(s, f);
+  if (frames[f].pinCount > 0 && --frames[f].pinCount == 0) unpinned(s, f);
+}
+
+void BufferPool::ready(const char* buffer)
+{
+  int f = frameOf(buffer);
+  Shard& s = shardOfFrame(f);
+  Lock lock(s.mutex);
+
+  markFilled(s, f);
+}
+
+void BufferPool::discard(const char* buffer)
+{
+  int f = frameOf(buffer);
+  Shard& s = shardOfFrame(f);
+  Lock lock(s.mutex);
+
+  if (frames[f].pinCount == 0) return;
+
+  // the frame is dropped before anyone else can pin the page.
+  // a page pinned by others as well was filled before, so it is kept
+  if (frames[f].pinCount == 1 && frames[f].fid >= 0) release(s, f);
+  else if (--frames[f].pinCount == 0) unpinned(s, f);
+}
+
+void BufferPool::invalidate(int fid, PageId pid)
+{
+  Shard& s = shardOf(fid, pid);
+  Lock lock(s.mutex);
+  int f = find(s, fid, pid);
+  if (f >= 0 && frames[f].pinCount == 0) release(s, f);
+}
+
+void BufferPool::invalidateFile(int fid)
+{
+  for (int i = 0; i < shardCount; i++) {
+    Shard& s = shards[i];
+    Lock lock(s.mutex);
+    // a pinned page is still read by whoever pinned it. it is left to age
+    // out, as a file opened again for writing gets a new id
+    for (int f = s.first; f < s.first + s.count; f++) {
+      if (frames[f].fid == fid && frames[f].pinCount == 0) release(s, f);
+    }
+  }
+}
+
+int BufferPool::getHitCount() const
+{
+  int n = 0;
+  for (int p = 0; p < POLICY_COUNT; p++) n += getHitCount((Policy) p);
+  return n;
+}
+
+int BufferPool::getMissCount() const
+{
+  int n = 0;
+  for (int p = 0; p < POLICY_COUNT; p++) n += getMissCount((Policy) p);
+  return n;
+}
+
+int BufferPool::getHitCount(Policy p) const
+{
+  int n = policyHits[p];
+  if (p != policy) return n;
+  for (int i = 0; i < shardCount; i++) {
+    Lock lock(shards[i].mutex);
+    n += shards[i].hitCount;
+  }
+  return n;
+}
+
+int BufferPool::getMissCount(Policy p) const
+{
+  int n = policyMisses[p];
+  if (p != policy) return n;
+  for (int i = 0; i < shardCount; i++) {
+    Lock lock(shards[i].mutex);
+    n += shards[i].missCount;
+  }
+  return n;
+}
+
+RC BufferPool::writeBack(Shard& s, int f)
+{
+  RC rc;
+
+  // the page is written without holding the shard, as PageFile::read()
+  // reads a page. the frame is pinned meanwhile, so it is not chosen again.
+  // a page written to while on its way out is dirty again afterwards.
+  // a flush of the file waits for the write, so that the file cannot be
+  // closed under it
+  const PageFile* owner = frames[f].owner;
+  PageId pid = frames[f].pid;
+  pinned(s, f);
+  frames[f].pinCount++;
+  frames[f].dirty = false;
+  frames[f].writing = true;
+
+  pthread_mutex_unlock(&s.mutex);
+  rc = owner->writePage(pid, data + (size_t) f * frameSize);
+  pthread_mutex_lock(&s.mutex);
+
+  if (rc < 0) frames[f].dirty = true;
+  frames[f].writing = false;
+  pthread_cond_broadcast(&s.filled);
+
+  // the clean page goes back to the LRU end of its list as the next victim,
+  // unless another thread still has it pinned
+  if (--frames[f].pinCount == 0 && policy != CLOCK && !frames[f].once)
+    pushBack(s.mruFrame, s.lruFrame, f);
+  return rc;
+}
+
+// order frames by file and page id so that a flush writes each file
+// front to back
+struct BufferPool::FrameOrder {
+  const Frame* frames;
+  bool operator() (int a, int b) const {
+    if (frames[a].fid != frames[b].fid) return frames[a].fid < frames[b].fid;
+    return frames[a].pid < frames[b].pid;
+  }
+};
+
+RC BufferPool::flushFrames(int* list, int n)
+{
+  RC    rc;
+  char* buffers[PageFile::MAX_IO_PAGES];
+  int   run;
+
+  FrameOrder order = { frames };
+  std::sort(list, list + n, order);
+
+  for (int i = 0; i < n; i += run) {
+    // find the run of consecutive pages of the same file
+    const Frame& first = frames[list[i]];
+    buffers[0] = data + (size_t) list[i] * frameSize;
+    for (run = 1; run < PageFile::MAX_IO_PAGES && i + run < n; run++) {
+      const Frame& next = frames[list[i + run]];
+      if (next.fid != first.fid || next.pid != first.pid + run) break;
+      buffers[run] = data + (size_t) list[i + run] * frameSize;
+    }
+
+    // and write it out at once
+    if ((rc = first.owner->writePages(first.pid, buffers, run)) < 0) return rc;
+    for (int j = 0; j < run; j++) frames[list[i + j]].dirty = false;
+  }
+
+  return 0;
+}
+
+RC BufferPool::flushDirty(int fid)
+{
+  RC  rc;
+  int n = 0;
+
+  // wait for the pages of the file being written back by evicting threads.
+  // a page that failed to be written is dirty again and flushed below
+  for (int i = 0; i < shardCount; i++) {
+    Shard& s = shards[i];
+    for (int f = s.first; f < s.first + s.count; f++) {
+      if (frames[f].writing && (fid < 0 || frames[f].fid == fid)) {
+        // the shard may change while it is not held, so look at it again
+        pthread_cond_wait(&s.filled, &s.mutex);
+        f = s.first - 1;
+      }
+    }
+  }
+
+  // collect the dirty frames of the file (of every file if fid < 0)
+  int* list = new int[frameCount];
+  for (int f = 0; f < frameCount; f++) {
+    if (frames[f].dirty && (fid < 0 || frames[f].fid == fid)) list[n++] = f;
+  }
+
+  rc = flushFrames(list, n);
+  delete [] list;
+  return rc;
+}
+
+RC BufferPool::flushFile(int fid)
+{
+  RC rc;
+
+  // the runs of a file cross the shards, so all of them are held
+  lockAll();
+  rc = flushDirty(fid);
+  unlockAll();
+  return rc;
+}
+
+RC BufferPool::flushAll()
+{
+  RC rc;
+
+  lockAll();
+  rc = flushDirty(-1);
+  unlockAll();
+  return rc;
+}
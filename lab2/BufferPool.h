@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <pthread.h>
+#include "Bruinbase.h"
+
+typedef int PageId;
+
+class PageFile;
+
+/**
+ * a fixed-size pool of page frames shared by all PageFiles.
+ * frames are located through a hash table keyed by (fid, pid) and
+ * replaced by one of the policies below:
+ *   LRU    evicts the least recently used page.
+ *   CLOCK  sweeps the frames and evicts the first page not used since
+ *          the last sweep.
+ *   TWO_Q  keeps pages used once in a FIFO queue of 1/4 of the frames and
+ *          remembers the pages evicted from it. only a page used again,
+ *          in the FIFO or soon after it was evicted from it, enters the
+ *          main LRU queue, so a table scan cannot push the hot index
+ *          pages out.
+ * a large pool is split into shards by the hash of (fid, pid). each shard
+ * has its own frames, hash table, replacement state, statistics and mutex,
+ * so threads working on pages of different shards do not wait for each other.
+ * a frame may hold a dirty page that has not been written to disk yet.
+ * such a page is written back through its owning PageFile when it is
+ * evicted or when its file is flushed.
+ * a pinned frame is never evicted, so callers can read a pinned page
+ * in place until they unpin it.
+ * the shard mutexes let the pool be shared with the read-ahead thread
+ * and with concurrent readers. lookup() and allocate() return their
+ * frame pinned, so that it cannot be evicted by another thread before the
+ * caller is done with it. a page being read in by one thread is waited for
+ * by the others instead of being read twice.
+ */
+class BufferPool {
+ public:
+  static const int DEFAULT_FRAME_COUNT = 10;  // # frames unless resized
+  static const int MAX_SHARDS = 16;           // max # shards of a pool
+  static const int MIN_SHARD_FRAMES = 64;     // min # frames of a shard
+
+  // replacement policies
+  enum Policy { LRU, CLOCK, TWO_Q };
+  static const int POLICY_COUNT = 3;
+  static const Policy DEFAULT_POLICY = LRU;   // the policy unless set
+
+  /**
+   * create a pool of frameCount frames of frameSize bytes each.
+   * a frame must be large enough for the largest page of any file.
+   * @param frameCount[IN] the number of frames in the pool
+   * @param frameSize[IN] the size of each frame in bytes
+   */
+  BufferPool(int frameCount, int frameSize);
+  ~BufferPool();
+
+  /**
+   * change the number of frames in the pool.
+   * all dirty pages are written back and all cached pages are dropped.
+   * the pool cannot be resized while a page is pinned, and no other
+   * thread may use the pool during the call.
+   * @param frameCount[IN] the new number of frames (must be > 0)
+   * @return error code. 0 if no error
+   */
+  RC resize(int frameCount);
+
+  /**
+   * change the number and the size of the frames in the pool.
+   * like resize(), all cached pages are dropped.
+   * @param frameCount[IN] the new number of frames (must be > 0)
+   * @param frameSize[IN] the new size of each frame in bytes
+   * @return error code. 0 if no error
+   */
+  RC resize(int frameCount, int frameSize);
+
+  /**
+   * change the replacement policy of the pool.
+   * like resize(), all cached pages are dropped.
+   * @param policy[IN] the new policy
+   * @return error code. 0 if no error
+   */
+  RC setPolicy(Policy policy);
+
+  /**
+   * @return the replacement policy of the pool
+   */
+  Policy getPolicy() const { return policy; }
+
+  /**
+   * @return the name of the policy: "lru", "clock" or "2q"
+   */
+  static const char* policyName(Policy policy);
+
+  /**
+   * @return the number of frames in the pool
+   */
+  int size() const { return frameCount; }
+
+  /**
+   * @return the size of each frame in bytes
+   */
+  int getFrameSize() const { return frameSize; }
+
+  /**
+   * look up the page (fid, pid) in the pool and pin its frame.
+   * a successful lookup makes the page the most recently used one.
+   * if another thread is still filling the frame, wait until it is done.
+   * the frame must be released by unpin().
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   * @return the frame buffer holding the page. NULL if it is not cached
+   */
+  char* lookup(int fid, PageId pid);
+
+  /**
+   * check whether the page (fid, pid) is in the pool.
+   * unlike lookup(), this does not affect the LRU order or the statistics.
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   * @return true if the page is cached
+   */
+  bool contains(int fid, PageId pid) const;
+
+  /**
+   * assign a frame to the page (fid, pid), evicting the least recently
+   * used unpinned page if no frame is free. a dirty victim is written
+   * back first. RC_BUFFER_FULL is returned if every frame is pinned.
+   * if the page is already cached, its frame is returned as it is.
+   * otherwise the content of the returned buffer is undefined and
+   * must be filled by the caller. other threads do not see the page
+   * until the caller marks it filled with ready() or unpin(), or drops
+   * it with discard(). the frame is returned pinned and must be released
+   * by unpin() or discard().
+   * @param owner[IN] the PageFile the page belongs to
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   * @param dirty[IN] mark the page dirty
+   * @param buffer[OUT] the frame buffer assigned to the page
+   * @return error code. 0 if no error
+   */
+  RC allocate(const PageFile* owner, int fid, PageId pid, bool dirty, char*& buffer);
+
+  /**
+   * assign a new frame to the page (fid, pid) unless it is cached, so that
+   * the page can be read into it. unlike allocate(), a cached frame is never
+   * returned, since it may be pinned by a reader or dirty. the new frame is
+   * pinned and hidden from other threads, as one from allocate().
+   * @param owner[IN] the PageFile the page belongs to
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   * @param buffer[OUT] the frame buffer assigned to the page. NULL if the page is cached
+   * @return error code. 0 if no error
+   */
+  RC allocateNew(const PageFile* owner, int fid, PageId pid, char*& buffer);
+
+  /**
+   * cache a clean copy of the page (fid, pid) unless it is already cached.
+   * the page becomes visible to lookup() only once it is fully copied.
+   * nothing is done if every frame is pinned.
+   * @param owner[IN] the PageFile the page belongs to
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   * @param page[IN] the content of the page (owner->pageSize() bytes)
+   * @return error code. 0 if no error
+   */
+  RC install(const PageFile* owner, int fid, PageId pid, const char* page);
+
+  /**
+   * pin the frame so that it is not evicted until it is unpinned.
+   * a frame can be pinned multiple times.
+   * @param buffer[IN] a frame buffer returned by lookup() or allocate()
+   */
+  void pin(const char* buffer);
+
+  /**
+   * undo one pin() of the frame.
+   * a frame filled after allocate() becomes visible to other threads.
+   * @param buffer[IN] the frame buffer passed to pin()
+   */
+  void unpin(const char* buffer);
+
+  /**
+   * mark the frame filled after allocate(), so that other threads can
+   * look up the page. the frame stays pinned.
+   * @param buffer[IN] a frame buffer returned by allocate()
+   */
+  void ready(const char* buffer);
+
+  /**
+   * undo the pin of allocate() and drop the page, e.g. when it could not
+   * be read. threads waiting for the page find it uncached.
+   * @param buffer[IN] a frame buffer returned by allocate()
+   */
+  void discard(const char* buffer);
+
+  /**
+   * drop the page (fid, pid) from the pool if it is cached and not pinned.
+   * the page is dropped even if it is dirty.
+   * @param fid[IN] the id of the file of the page (see PageFile)
+   * @param pid[IN] the page id
+   */
+  void invalidate(int fid, PageId pid);
+
+  /**
+   * drop every cached page of the file fid that is not pinned.
+   * dirty pages are dropped without being written; call flushFile() first.
+   * @param fid[IN] the id of the file
+   */
+  void invalidateFile(int fid);
+
+  /**
+   * write every dirty page of the file fid back to disk in pid order.
+   * runs of consecutive pages are written with a single vectored write.
+   * the pages stay in the pool as clean pages.
+   * a page being written back by an evicting thread is waited for, so
+   * the file may be closed once the call returns.
+   * @param fid[IN] the id of the file
+   * @return error code. 0 if no error
+   */
+  RC flushFile(int fid);
+
+  /**
+   * write every dirty page in the pool back to disk.
+   * @return error code. 0 if no error
+   */
+  RC flushAll();
+
+  /**
+   * @return the number of shards of the pool
+   */
+  int getShardCount() const { return shardCount; }
+
+  /**
+   * @return the total # of lookups that found the page in the pool
+   */
+  int getHitCount() const;
+
+  /**
+   * @return the total # of lookups that did not find the page in the pool
+   */
+  int getMissCount() const;
+
+  /**
+   * @return the # of lookups that found the page while the policy was in use
+   */
+  int getHitCount(Policy policy) const;
+
+  /**
+   * @return the # of lookups that missed the page while the policy was in use
+   */
+  int getMissCount(Policy policy) const;
+
+ private:
+  struct Frame {
+    const PageFile* owner;  // the PageFile the cached page belongs to
+    int    fid;        // file id of the cached page (-1 if the frame is free)
+    PageId pid;        // page id of the cached page
+    bool   dirty;      // the page was modified but not written to disk
+    int    pinCount;   // # outstanding pins. pinned frames are not in the LRU list
+    bool   loading;    // the page is being filled by the thread that allocated it
+    bool   writing;    // the page is being written back by the thread evicting it
+    bool   referenced; // CLOCK: the page was used since the hand last passed
+                       // TWO_Q: the page was used since it entered the FIFO
+    bool   once;       // TWO_Q: the page is in the FIFO queue, pinned or not
+    int    hashNext;   // next frame in the same hash bucket
+    int    prev;       // previous frame in the LRU, FIFO (or free) list
+    int    next;       // next frame in the LRU, FIFO (or free) list
+  };
+
+  // a slice of the frames with its own lookup and replacement state.
+  // frame numbers are global, so lists of a shard link frames of the pool
+  struct Shard {
+    int    first;        // the first frame of the shard
+    int    count;        // # frames of the shard
+
+    int    bucketCount;  // # hash buckets (a power of two)
+    int*   buckets;      // first frame of each hash bucket (-1 if empty)
+
+    int    mruFrame;     // head of the LRU list (most recently used)
+    int    lruFrame;     // tail of the LRU list (least recently used)
+    int    freeFrame;    // head of the free frame list
+
+    int    clockHand;    // CLOCK: the next frame to look at, from first
+    int    lastFound;    // TWO_Q: the frame of the last lookup hit (-1 if none)
+
+    int    newFrame;     // TWO_Q: head of the FIFO queue (newest page)
+    int    oldFrame;     // TWO_Q: tail of the FIFO queue (oldest page)
+    int    onceCount;    // TWO_Q: # frames in the FIFO queue
+    int    ghostCount;   // TWO_Q: # pages remembered after leaving the FIFO
+    int    ghostOldest;  // TWO_Q: the slot of the oldest remembered page
+    int    ghostSlots;   // TWO_Q: the capacity of the ghost ring
+    int    ghostBuckets; // TWO_Q: # hash buckets of the ghosts (a power of two)
+    int*   ghostFid;     // TWO_Q: ring of the remembered pages (fid -1 if dropped)
+    PageId* ghostPid;
+    int*   ghostNext;    // TWO_Q: next ghost slot in the same hash bucket
+    int*   ghostHash;    // TWO_Q: first ghost slot of each hash bucket (-1 if empty)
+
+    int    hitCount;     // # lookup hits in the shard
+    int    missCount;    // # lookup misses in the shard
+
+    mutable pthread_mutex_t mutex;  // guards the shard and its frames
+    pthread_cond_t  filled;         // signaled when a loading frame is filled or dropped,
+                                    // and when a page has been written back
+  };
+
+  int    frameCount;   // # frames in the pool
+  int    frameSize;    // size of each frame in bytes
+  Frame* frames;       // frame descriptors
+  char*  data;         // frameCount * frameSize bytes of page buffers
+
+  int    shardCount;   // # shards
+  int    shardFrames;  // # frames of each shard but the last, which takes the rest
+  Shard* shards;
+
+  Policy policy;       // the replacement policy
+  int    policyHits[POLICY_COUNT];    // # lookup hits of each policy before
+  int    policyMisses[POLICY_COUNT];  // the shards were last rebuilt
+
+  struct FrameOrder;
+  class  Lock;
+
+  void   init(int count);
+  void   destroy();
+  RC     rebuild(int count, int size, Policy newPolicy);
+  void   lockAll() const;
+  void   unlockAll() const;
+  unsigned hashOf(int fid, PageId pid) const;
+  Shard& shardOf(int fid, PageId pid) const;
+  Shard& shardOfFrame(int f) const;
+  int    find(const Shard& s, int fid, PageId pid) const;
+  int    findFilled(Shard& s, int fid, PageId pid);
+  int    frameOf(const char* buffer) const;
+  void   unlink(int& head, int& tail, int f);
+  void   pushFront(int& head, int& tail, int f);
+  void   pushBack(int& head, int& tail, int f);
+  void   hashRemove(Shard& s, int f);
+  void   pinned(Shard& s, int f);
+  void   unpinned(Shard& s, int f);
+  void   enter(Shard& s, int f);
+  void   leave(Shard& s, int f);
+  int    victim(Shard& s);
+  bool   ghostRemove(Shard& s, int fid, PageId pid);
+  void   ghostAdd(Shard& s, int fid, PageId pid);
+  void   release(Shard& s, int f);
+  void   markFilled(Shard& s, int f);
+  RC     take(Shard& s, const PageFile* owner, int fid, PageId pid, int& f);
+  RC     writeBack(Shard& s, int f);
+  RC     flushFrames(int* list, int n);
+  RC     flushDirty(int fid);
+
+  // not copyable
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,145 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <algorithm>
+#include "Bruinbase.h"
+#include "IndexSorter.h"
+
+using std::vector;
+
+IndexSorter::IndexSorter(int runEntries)
+{
+  this->runEntries = (runEntries > 0) ? runEntries : DEFAULT_RUN_ENTRIES;
+  count = 0;
+  sorted = false;
+  position = 0;
+}
+
+IndexSorter::~IndexSorter()
+{
+  // temporary files are removed when they are closed
+  for (unsigned i = 0; i < runs.size(); i++) fclose(runs[i]);
+}
+
+bool IndexSorter::less(const Entry& e1, const Entry& e2)
+{
+  if (e1.key != e2.key) return e1.key < e2.key;
+  return e1.rid < e2.rid;
+}
+
+bool IndexSorter::after(const Head& h1, const Head& h2)
+{
+  // std heaps keep the largest element on top, so compare backwards
+  return less(h2.entry, h1.entry);
+}
+
+RC IndexSorter::add(int key, const RecordId& rid)
+{
+  RC rc;
+  Entry e;
+
+  if (sorted) return RC_INVALID_FILE_MODE;
+
+  // the memory is full. write the pairs out as a sorted run
+  if ((int) entries.size() >= runEntries) {
+    if ((rc = spill()) < 0) return rc;
+  }
+
+  e.key = key;
+  e.rid = rid;
+  entries.push_back(e);
+  count++;
+
+  return 0;
+}
+
+RC IndexSorter::spill()
+{
+  FILE* run;
+
+  std::sort(entries.begin(), entries.end(), less);
+
+  if ((run = tmpfile()) == NULL) return RC_FILE_OPEN_FAILED;
+  runs.push_back(run);
+  if (fwrite(&entries[0], sizeof(Entry), entries.size(), run) != entries.size()) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  entries.clear();
+  return 0;
+}
+
+RC IndexSorter::readRun(int run, Head& head)
+{
+  if (fread(&head.entry, sizeof(Entry), 1, runs[run]) != 1) {
+    return feof(runs[run]) ? RC_END_OF_TREE : RC_FILE_READ_FAILED;
+  }
+  head.run = run;
+  return 0;
+}
+
+RC IndexSorter::sort()
+{
+  RC   rc;
+  Head head;
+
+  if (sorted) return 0;
+  sorted = true;
+
+  // everything fits in memory. no merge needed
+  if (runs.empty()) {
+    std::sort(entries.begin(), entries.end(), less);
+    position = 0;
+    return 0;
+  }
+
+  // the rest of the pairs become the last run
+  if (!entries.empty() && (rc = spill()) < 0) return rc;
+  vector<Entry>().swap(entries);
+
+  // start the merge with the first pair of every run
+  for (unsigned i = 0; i < runs.size(); i++) {
+    rewind(runs[i]);
+    if ((rc = readRun(i, head)) == RC_END_OF_TREE) continue;
+    if (rc < 0) return rc;
+    heads.push_back(head);
+  }
+  std::make_heap(heads.begin(), heads.end(), after);
+
+  return 0;
+}
+
+RC IndexSorter::next(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if (!sorted) return RC_INVALID_FILE_MODE;
+
+  if (runs.empty()) {
+    if (position >= (int) entries.size()) return RC_END_OF_TREE;
+    key = entries[position].key;
+    rid = entries[position].rid;
+    position++;
+    return 0;
+  }
+
+  if (heads.empty()) return RC_END_OF_TREE;
+
+  // take the smallest head and replace it with the next pair of its run
+  std::pop_heap(heads.begin(), heads.end(), after);
+  Head& head = heads.back();
+  key = head.entry.key;
+  rid = head.entry.rid;
+  if ((rc = readRun(head.run, head)) == RC_END_OF_TREE) {
+    heads.pop_back();
+  } else if (rc < 0) {
+    return rc;
+  } else {
+    std::push_heap(heads.begin(), heads.end(), after);
+  }
+
+  return 0;
+}
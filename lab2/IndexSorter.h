@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef INDEXSORTER_H
+#define INDEXSORTER_H
+
+#include <cstdio>
+#include <vector>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+
+/**
+ * sorts (key, RecordId) pairs by key for building a B+tree bottom-up.
+ * pairs are sorted in memory. when more than runEntries pairs are added,
+ * sorted runs are spilled to temporary files and merged while reading.
+ * equal keys come out in RecordId order.
+ */
+class IndexSorter {
+ public:
+  static const int DEFAULT_RUN_ENTRIES = 1 << 20;  // # pairs sorted in memory (12MB)
+
+  /**
+   * @param runEntries[IN] max # pairs kept in memory
+   */
+  IndexSorter(int runEntries = DEFAULT_RUN_ENTRIES);
+  ~IndexSorter();
+
+  /**
+   * add a pair. pairs cannot be added after sort().
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId of the tuple
+   * @return error code. 0 if no error
+   */
+  RC add(int key, const RecordId& rid);
+
+  /**
+   * finish adding pairs and prepare to read them back in key order.
+   * @return error code. 0 if no error
+   */
+  RC sort();
+
+  /**
+   * read the next pair in key order.
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId of the tuple
+   * @return error code. RC_END_OF_TREE after the last pair
+   */
+  RC next(int& key, RecordId& rid);
+
+  /**
+   * @return the number of pairs added
+   */
+  int size() const { return count; }
+
+  /**
+   * @return the number of runs spilled to temporary files
+   */
+  int runCount() const { return (int) runs.size(); }
+
+ private:
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+  static bool less(const Entry& e1, const Entry& e2);
+
+  // the head of a run in the merge
+  struct Head {
+    Entry entry;
+    int   run;
+  };
+  static bool after(const Head& h1, const Head& h2);
+
+  int  runEntries;             // max # pairs in memory
+  int  count;                  // # pairs added
+  bool sorted;                 // sort() was called
+  std::vector<Entry> entries;  // the pairs in memory
+  int  position;               // next pair to read from entries without runs
+  std::vector<FILE*> runs;     // sorted runs spilled to temporary files
+  std::vector<Head>  heads;    // heap of the smallest unread pair of each run
+
+  RC spill();
+  RC readRun(int run, Head& head);
+
+  // not copyable
+  IndexSorter(const IndexSorter&);
+  IndexSorter& operator=(const IndexSorter&);
+};
+
+#endif // INDEXSORTER_H
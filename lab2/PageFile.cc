@@ -9,29 +9,160 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include <cstring>
+#include <cstdlib>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <vector>
 
 using std::string;
 
+// the first bytes of the header page of a file with a configurable page size
+struct FileHeader {
+  int magic;     // FILE_MAGIC
+  int pageSize;  // the page size of the file in bytes
+  int format;    // the format of the pages, chosen by the user of the file
+};
+
+static const int FILE_MAGIC = 0x46425242;  // "BRBF"
+
+// a file whose pages may stay cached while it is not open.
+// the pages are valid as long as the file keeps its size and mtime
+struct CachedFile {
+  dev_t  dev;
+  ino_t  ino;
+  off_t  size;
+  struct timespec mtime;
+  int    fid;   // the id of the pages in the buffer pool
+};
+
+static std::vector<CachedFile> cachedFiles;
+static int lastFid = 0;
+static int largestPageSize = 0;  // the largest page size of the files opened so far
+static int cacheMB = 0;          // the size of the pool set in MB, 0 if set in pages
+static pthread_mutex_t cachedFilesMutex = PTHREAD_MUTEX_INITIALIZER; // guards the four above
+
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+bool PageFile::writeBack = true;
+bool PageFile::memoryMapped = false;
+int PageFile::defaultPageSize = PageFile::DEFAULT_PAGE_SIZE;
+int PageFile::readAheadPages = PageFile::DEFAULT_READ_AHEAD_PAGES;
+BufferPool PageFile::bufferPool(BufferPool::DEFAULT_FRAME_COUNT, PageFile::DEFAULT_PAGE_SIZE);
+// defined after the pool so that the thread is stopped before the pool goes away
+ReadAhead PageFile::readAhead;
+
+RC PageFile::setCacheSize(int pages)
+{
+  RC rc;
+
+  pthread_mutex_lock(&cachedFilesMutex);
+  if ((rc = bufferPool.resize(pages)) == 0) cacheMB = 0;
+  pthread_mutex_unlock(&cachedFilesMutex);
+  return rc;
+}
+
+RC PageFile::setCacheSizeMB(int mb)
+{
+  RC rc;
+
+  if (mb <= 0) return RC_INVALID_CACHE_SIZE;
+
+  // the pool holds as many pages as fit in mb at its current frame size
+  pthread_mutex_lock(&cachedFilesMutex);
+  rc = bufferPool.resize(mb * (1024 * 1024 / bufferPool.getFrameSize()));
+  if (rc == 0) cacheMB = mb;
+  pthread_mutex_unlock(&cachedFilesMutex);
+  return rc;
+}
+
+RC PageFile::fitFrames(int pageSize)
+{
+  RC  rc = 0;
+  int size;
+
+  pthread_mutex_lock(&cachedFilesMutex);
+  if (pageSize > largestPageSize) largestPageSize = pageSize;
+
+  // frames of the default page size, unless a file with larger pages is used
+  size = (defaultPageSize > largestPageSize) ? defaultPageSize : largestPageSize;
+  if (size != bufferPool.getFrameSize()) {
+    // a pool sized in MB keeps its memory, one sized in pages its # pages
+    rc = bufferPool.resize(cacheMB > 0 ? cacheMB * (1024 * 1024 / size) : bufferPool.size(), size);
+  }
+  pthread_mutex_unlock(&cachedFilesMutex);
+  return rc;
+}
+
+RC PageFile::setWriteBack(bool on)
+{
+  writeBack = on;
+  return on ? 0 : bufferPool.flushAll();
+}
+
+RC PageFile::setDefaultPageSize(int size)
+{
+  // only powers of two, so that pages stay aligned to the OS pages
+  if (size < PAGE_SIZE || size > MAX_PAGE_SIZE || (size & (size - 1)) != 0) {
+    return RC_INVALID_PAGE_SIZE;
+  }
+  defaultPageSize = size;
+
+  // if a page is pinned, the frames stay as they are and
+  // open() grows them when a file needs larger ones
+  fitFrames(0);
+  return 0;
+}
+
+RC PageFile::setReadAhead(int pages)
+{
+  if (pages < 0) return RC_INVALID_CACHE_SIZE;
+  readAheadPages = (pages > MAX_IO_PAGES) ? MAX_IO_PAGES : pages;
+  return 0;
+}
 
 PageFile::PageFile() 
 { 
   fd = -1; 
+  fid = -1;
   epid = 0; 
+  readOnly = false;
+  map = NULL;
+  psize = PAGE_SIZE;
+  base = 0;
+  format = 0;
+  lastPid = aheadPid = -1;
+  seqSteps = 0;
+  pthread_mutex_init(&accessMutex, NULL);
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
+  fid = -1;
   epid = 0;
+  readOnly = false;
+  map = NULL;
+  psize = PAGE_SIZE;
+  base = 0;
+  format = 0;
+  lastPid = aheadPid = -1;
+  seqSteps = 0;
+  pthread_mutex_init(&accessMutex, NULL);
   open(filename.c_str(), mode);
 }
 
+PageFile::~PageFile()
+{
+  // make sure no dirty page outlives the file
+  if (fd > 0) close();
+  pthread_mutex_destroy(&accessMutex);
+}
+
 RC PageFile::open(const string& filename, char mode)
 {
   RC   rc;
@@ -61,31 +192,91 @@ RC PageFile::open(const string& filename, char mode)
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+  readOnly = (oflag == O_RDONLY);
+
+  // find the page size of the file from its header page
+  if ((rc = readHeader(statbuf.st_size)) < 0) { ::close(fd); fd = -1; return rc; }
+
+  // a frame of the buffer pool must hold a whole page of the file
+  if ((rc = fitFrames(psize)) < 0) { ::close(fd); fd = -1; return rc; }
+  fid = fileId(statbuf, readOnly);
+  epid = statbuf.st_size / psize - base;
+  if (epid < 0) epid = 0;
+  lastPid = aheadPid = -1;
+  seqSteps = 0;
+
+  // a read-only file never changes its size, so it can be mapped as a whole.
+  // if mapping fails, fall back to the buffer pool
+  if (memoryMapped && readOnly && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t) offsetOf(epid), PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) map = (char*) addr;
+  }
 
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
-
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // the read-ahead thread must be done with the file descriptor
+  if (readOnly) readAhead.cancel(this);
+
+  // write the dirty pages and evict all cached pages for this file.
+  // the pages of a file opened for reading stay for the next reader
+  rc = bufferPool.flushFile(fid);
+  if (!readOnly) bufferPool.invalidateFile(fid);
+
+  // unmap the file if it was mapped
+  if (map != NULL) {
+    ::munmap(map, (size_t) offsetOf(epid));
+    map = NULL;
   }
 
+  // close the file
+  if (::close(fd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
+  fid = -1;
   epid = 0;
-  return 0;
+  readOnly = false;
+  psize = PAGE_SIZE;
+  base = 0;
+  format = 0;
+  return rc;
+}
+
+RC PageFile::flush()
+{
+  if (fd <= 0) return RC_FILE_WRITE_FAILED;
+  return bufferPool.flushFile(fid);
+}
+
+RC PageFile::advise(AccessPattern pattern) const
+{
+  int advice;
+
+  if (fd <= 0) return RC_FILE_READ_FAILED;
+
+  // a mapped file is advised through madvise, otherwise through fadvise
+  if (map != NULL) {
+    switch (pattern) {
+    case SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case RANDOM:     advice = MADV_RANDOM;     break;
+    default:         advice = MADV_NORMAL;     break;
+    }
+    return (::madvise(map, (size_t) offsetOf(epid), advice) < 0) ? RC_FILE_READ_FAILED : 0;
+  }
+
+  switch (pattern) {
+  case SEQUENTIAL: advice = POSIX_FADV_SEQUENTIAL; break;
+  case RANDOM:     advice = POSIX_FADV_RANDOM;     break;
+  default:         advice = POSIX_FADV_NORMAL;     break;
+  }
+  return (::posix_fadvise(fd, 0, 0, advice) != 0) ? RC_FILE_READ_FAILED : 0;
 }
 
 PageId PageFile::endPid() const 
@@ -93,38 +284,190 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+int PageFile::fileId(const struct stat& st, bool reuse)
+{
+  int fid = -1;
+
+  pthread_mutex_lock(&cachedFilesMutex);
+
+  // a file read before keeps its id, and its pages in the cache,
+  // unless it was changed since. the old pages are never looked up
+  // again and age out of the cache
+  for (unsigned i = 0; i < cachedFiles.size(); i++) {
+    CachedFile& c = cachedFiles[i];
+    if (c.dev != st.st_dev || c.ino != st.st_ino) continue;
+    if (reuse && c.size == st.st_size && c.mtime.tv_sec == st.st_mtim.tv_sec &&
+        c.mtime.tv_nsec == st.st_mtim.tv_nsec) fid = c.fid;
+    else cachedFiles.erase(cachedFiles.begin() + i);
+    break;
+  }
+
+  // a file opened for writing always gets a new id,
+  // so that no reader shares its pages before they are written
+  if (fid < 0) {
+    fid = ++lastFid;
+    if (reuse) {
+      CachedFile c = { st.st_dev, st.st_ino, st.st_size, st.st_mtim, fid };
+      cachedFiles.push_back(c);
+    }
+  }
+
+  pthread_mutex_unlock(&cachedFilesMutex);
+  return fid;
+}
+
+RC PageFile::readHeader(off_t fileSize)
+{
+  FileHeader header;
+
+  // a new file opened for writing gets a header with the default page size
+  if (fileSize == 0 && !readOnly) {
+    char* page = (char*) calloc(1, defaultPageSize);
+    header.magic = FILE_MAGIC;
+    header.pageSize = defaultPageSize;
+    header.format = 0;
+    memcpy(page, &header, sizeof(header));
+    ssize_t written = ::pwrite(fd, page, defaultPageSize, 0);
+    free(page);
+    if (written != defaultPageSize) return RC_FILE_WRITE_FAILED;
+    __sync_add_and_fetch(&writeCount, 1);
+    psize = defaultPageSize;
+    base = 1;
+    format = 0;
+    return 0;
+  }
+
+  // a file without the magic number is an old file with 1KB pages
+  psize = PAGE_SIZE;
+  base = 0;
+  format = 0;
+  if (::pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+      header.magic != FILE_MAGIC) return 0;
+
+  if (header.pageSize < PAGE_SIZE || header.pageSize > MAX_PAGE_SIZE ||
+      (header.pageSize & (header.pageSize - 1)) != 0) return RC_INVALID_FILE_FORMAT;
+  psize = header.pageSize;
+  base = 1;
+  // headers written before the format was kept hold 0 there
+  format = header.format;
+
+  return 0;
+}
+
+RC PageFile::setFormat(int newFormat)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  FileHeader header;
+
+  if (fd <= 0 || readOnly) return RC_FILE_WRITE_FAILED;
+
+  // an old file has no header to keep the format in
+  if (base == 0) return RC_INVALID_FILE_FORMAT;
+
+  header.magic = FILE_MAGIC;
+  header.pageSize = psize;
+  header.format = newFormat;
+  if (::pwrite(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  __sync_add_and_fetch(&writeCount, 1);
+  format = newFormat;
+
+  return 0;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
   RC rc;
+  char* frame;
+
   if (pid < 0) return RC_INVALID_PID; 
+  if (fd <= 0 || readOnly) return RC_FILE_WRITE_FAILED;
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
+  // in write-through mode, write the buffer to the disk page first
+  if (!writeBack && (rc = writePage(pid, buffer)) < 0) return rc;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
-
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
-    }
+  // keep the new content of the page in the cache.
+  // in write-back mode the page stays dirty until it is evicted or flushed
+  if ((rc = bufferPool.allocate(this, fid, pid, writeBack, frame)) < 0) {
+    bufferPool.invalidate(fid, pid);
+    return rc;
   }
+  memcpy(frame, buffer, psize);
+  bufferPool.unpin(frame);
 
   // if the written pid >= end pid, update the end pid
   if (pid >= epid) epid = pid + 1;
 
+  return 0;
+}
+
+RC PageFile::writeRange(PageId startPid, int n, const void* buffer)
+{
+  RC rc;
+  char* frame;
+  const char* page = (const char*) buffer;
+
+  if (startPid < 0 || n < 0) return RC_INVALID_PID; 
+  if (fd <= 0 || readOnly) return RC_FILE_WRITE_FAILED;
+
+  // in write-back mode the pages simply become dirty in the cache
+  if (writeBack) {
+    for (int i = 0; i < n; i++) {
+      if ((rc = write(startPid + i, page + (size_t) i * psize)) < 0) return rc;
+    }
+    return 0;
+  }
+
+  // write the whole range at once
+  if (::pwrite(fd, buffer, (size_t) n * psize, offsetOf(startPid)) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  __sync_add_and_fetch(&writeCount, n);
+
+  // keep the cached copies of the pages up to date
+  for (int i = 0; i < n; i++) {
+    if ((rc = bufferPool.allocate(this, fid, startPid + i, false, frame)) < 0) {
+      bufferPool.invalidate(fid, startPid + i);
+      continue;
+    }
+    memcpy(frame, page + (size_t) i * psize, psize);
+    bufferPool.unpin(frame);
+  }
+
+  // if the written pid >= end pid, update the end pid
+  if (startPid + n > epid) epid = startPid + n;
+
+  return 0;
+}
+
+RC PageFile::writePage(PageId pid, const void* buffer) const
+{
+  // write the buffer to the disk page
+  if (::pwrite(fd, buffer, psize, offsetOf(pid)) < 0) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  // increase page write count
+  __sync_add_and_fetch(&writeCount, 1);
+
+  return 0;
+}
+
+RC PageFile::writePages(PageId pid, char* const* buffers, int n) const
+{
+  struct iovec iov[MAX_IO_PAGES];
+
+  if (n == 1) return writePage(pid, buffers[0]);
+
+  // gather the pages into a single write
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = buffers[i];
+    iov[i].iov_len = psize;
+  }
+  if (::pwritev(fd, iov, n, offsetOf(pid)) < 0) return RC_FILE_WRITE_FAILED;
+
   // increase page write count
-  writeCount++;
+  __sync_add_and_fetch(&writeCount, n);
 
   return 0;
 }
@@ -132,47 +475,258 @@ RC PageFile::write(PageId pid, const void* buffer)
 RC PageFile::read(PageId pid, void* buffer) const
 {
   RC rc;
+  char* frame;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  // a page of a mapped file is copied straight from the mapping
+  if (map != NULL) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+    memcpy(buffer, map + offsetOf(pid), psize);
+    return 0;
+  }
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
+  if ((rc = fetch(pid, frame)) < 0) return rc;
+  memcpy(buffer, frame, psize);
+  bufferPool.unpin(frame);
+
+  return 0;
+}
+
+RC PageFile::readRange(PageId startPid, int n, void* buffer) const
+{
+  if (startPid < 0 || n < 0 || startPid + n > epid) return RC_INVALID_PID; 
+
+  // pages of a mapped file are copied straight from the mapping
+  if (map != NULL) {
+    memcpy(buffer, map + offsetOf(startPid), (size_t) n * psize);
+    return 0;
   }
 
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  return load(startPid, n, (char*) buffer);
+}
+
+RC PageFile::prefetch(PageId startPid, int n) const
+{
+  // pages of a mapped file are always resident
+  if (map != NULL || startPid < 0) return 0;
+
+  // the pages up to the next uncached one were loaded by an earlier call
+  if (bufferPool.contains(fid, startPid)) return 0;
+
+  // do not let the pages push each other out of the cache
+  if (n > bufferPool.size() / 2) n = bufferPool.size() / 2;
+  if (startPid + n > epid) n = epid - startPid;
+  if (n <= 0) return 0;
+
+  return load(startPid, n, NULL);
+}
+
+RC PageFile::load(PageId startPid, int n, char* buffer) const
+{
+  struct iovec iov[MAX_IO_PAGES];
+  char*   frames[MAX_IO_PAGES];
+  char*   frame;
+  PageId  pid = startPid;
+  int     maxRun, run;
+  bool    full;
+  ssize_t got;
+
+  // never take more than half of the pool for a single run
+  maxRun = bufferPool.size() / 2;
+  if (maxRun > MAX_IO_PAGES) maxRun = MAX_IO_PAGES;
+  if (maxRun < 1) maxRun = 1;
+
+  while (pid < startPid + n) {
+    // a cached page is copied from the cache.
+    // only a read on behalf of the caller counts as a cache hit or miss
+    if (buffer == NULL && bufferPool.contains(fid, pid)) {
+      pid++;
+      continue;
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+    if (buffer != NULL && (frame = bufferPool.lookup(fid, pid)) != NULL) {
+      memcpy(buffer + (size_t) (pid - startPid) * psize, frame, psize);
+      bufferPool.unpin(frame);
+      pid++;
+      continue;
     }
+
+    // collect the frames for the run of uncached pages starting at pid.
+    // the run ends at a page cached in the meantime by another thread
+    full = false;
+    for (run = 0; run < maxRun && pid + run < startPid + n; run++) {
+      if (bufferPool.allocateNew(this, fid, pid + run, frames[run]) < 0) {
+        full = true;
+        break;
+      }
+      if (frames[run] == NULL) break;
+      iov[run].iov_base = frames[run];
+      iov[run].iov_len = psize;
+    }
+    // a first page cached in the meantime is taken from the cache
+    if (run == 0 && !full) continue;
+    if (run == 0) {
+      // every frame is pinned. read the page without caching it
+      if (buffer == NULL) return 0;
+      if (::pread(fd, buffer + (size_t) (pid - startPid) * psize, psize, offsetOf(pid)) < 0) {
+        return RC_FILE_READ_FAILED;
+      }
+      __sync_add_and_fetch(&readCount, 1);
+      pid++;
+      continue;
+    }
+
+    // read the whole run with a single system call
+    got = ::preadv(fd, iov, run, offsetOf(pid));
+    for (int i = 0; i < run; i++) {
+      if (got < 0) {
+        bufferPool.discard(frames[i]);
+        continue;
+      }
+      // the part of the run beyond the end of the file reads as zeros
+      if (got < (ssize_t) (i + 1) * psize) {
+        size_t valid = (got > (ssize_t) i * psize) ? got - i * psize : 0;
+        memset(frames[i] + valid, 0, psize - valid);
+      }
+      if (buffer != NULL) memcpy(buffer + (size_t) (pid + i - startPid) * psize, frames[i], psize);
+      bufferPool.unpin(frames[i]);
+    }
+    if (got < 0) return RC_FILE_READ_FAILED;
+
+    // increase the page read count
+    __sync_add_and_fetch(&readCount, run);
+    pid += run;
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, const char*& page) const
+{
+  RC rc;
+  char* frame;
+
+  // a page of a mapped file is always resident. no pin is needed
+  if (map != NULL) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+    page = map + offsetOf(pid);
+    return 0;
+  }
+
+  // the frame stays pinned until unpin()
+  if ((rc = fetch(pid, frame)) < 0) return rc;
+  page = frame;
+
+  return 0;
+}
+
+void PageFile::unpin(const char* page) const
+{
+  if (map == NULL) bufferPool.unpin(page);
+}
+
+RC PageFile::fetch(PageId pid, char*& frame) const
+{
+  RC rc;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  if (readOnly) noteAccess(pid);
+
+  do {
+    //
+    // if the page is in cache, read it from there.
+    // a page on its way in from the read-ahead thread is waited for
+    //
+    if ((frame = bufferPool.lookup(fid, pid)) != NULL) return 0;
+    if (readOnly && readAhead.wait(this, pid) &&
+        (frame = bufferPool.lookup(fid, pid)) != NULL) return 0;
+
+    // get a new cache frame for the page (possibly evicting the LRU page).
+    // a page cached by another thread in the meantime is looked up again
+    if ((rc = bufferPool.allocateNew(this, fid, pid, frame)) < 0) return rc;
+  } while (frame == NULL);
+
+  // read the page into the cache
+  if (::pread(fd, frame, psize, offsetOf(pid)) < 0) {
+    bufferPool.discard(frame);
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+
+  // let the threads waiting for the page see it
+  bufferPool.ready(frame);
+
+  // increase the page read count
+  __sync_add_and_fetch(&readCount, 1);
+
+  return 0;
+}
+
+void PageFile::noteAccess(PageId pid) const
+{
+  PageId startPid;
+  int    n;
+
+  // concurrent readers of the file share the run state
+  pthread_mutex_lock(&accessMutex);
+  n = nextWindow(pid, startPid);
+  pthread_mutex_unlock(&accessMutex);
+
+  if (n > 0) readAhead.request(this, startPid, n);
+}
+
+int PageFile::nextWindow(PageId pid, PageId& startPid) const
+{
+  int window, n;
+
+  // count the steps to the next page. rereading the same page does not
+  // break a sequential run, any other jump does
+  if (pid == lastPid) return 0;
+  if (pid == lastPid + 1) {
+    seqSteps++;
+  } else {
+    seqSteps = 0;
+    aheadPid = pid + 1;
+  }
+  lastPid = pid;
+
+  if (readAheadPages <= 0 || seqSteps < SEQUENTIAL_TRIGGER) return 0;
+
+  // the next window arrives while the reader is still in the current one.
+  // keep both well within the cache so that they do not push each other out
+  window = readAheadPages;
+  if (window > bufferPool.size() / 4) window = bufferPool.size() / 4;
+  if (window <= 0) return 0;
+
+  // request the next window once the reader is half way through the
+  // pages requested so far, so that the next run arrives in time
+  if (aheadPid <= pid) aheadPid = pid + 1;
+  if (aheadPid - pid > (window + 1) / 2) return 0;
+  n = (aheadPid + window > epid) ? epid - aheadPid : window;
+  if (n <= 0) return 0;
+
+  startPid = aheadPid;
+  aheadPid += n;
+  return n;
+}
+
+RC PageFile::loadAhead(PageId startPid, int n) const
+{
+  char*   buffer;
+  ssize_t got;
+
+  if ((buffer = (char*) malloc((size_t) n * psize)) == NULL) return RC_FILE_READ_FAILED;
+
+  // the whole run is read with a single system call
+  got = ::pread(fd, buffer, (size_t) n * psize, offsetOf(startPid));
+  if (got < 0) { free(buffer); return RC_FILE_READ_FAILED; }
+  n = got / psize;
 
   // increase the page read count
-  readCount++;
+  __sync_add_and_fetch(&readCount, n);
+
+  for (int i = 0; i < n; i++) {
+    bufferPool.install(this, fid, startPid + i, buffer + (size_t) i * psize);
+  }
 
+  free(buffer);
   return 0;
 }
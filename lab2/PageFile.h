@@ -11,7 +11,10 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <sys/types.h>
 #include "Bruinbase.h"
+#include "BufferPool.h"
+#include "ReadAhead.h"
 
 typedef int PageId;
 
@@ -19,16 +22,34 @@ typedef int PageId;
  * read/write a file in the unit of a page
  */
 class PageFile {
+  friend class BufferPool;
+  friend class ReadAhead;
+
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = 1024;    // the size of a page in a file without header
+  static const int MAX_PAGE_SIZE = 16384; // the largest page size of a file
+  static const int DEFAULT_PAGE_SIZE = 4096; // the page size of new files unless set
+  static const int MAX_IO_PAGES = 64;   // max # pages in one vectored I/O
+  static const int DEFAULT_READ_AHEAD_PAGES = 16; // read-ahead window unless set
+  static const int SEQUENTIAL_TRIGGER = 2; // # page steps before read-ahead starts
+
+  // expected access pattern of a file, used as a hint to the OS
+  enum AccessPattern { NORMAL, SEQUENTIAL, RANDOM };
 
   PageFile();
   PageFile(const std::string& filename, char mode);
+  ~PageFile();
 
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the default page size, which is recorded in a header page in
+   * front of page 0. a file without the header is read with 1KB pages.
+   * when a file opened in 'r' mode is read page after page, the following
+   * pages are loaded into the cache in the background (see setReadAhead()).
+   * when memory mapping is on, a file opened in 'r' mode is mapped into
+   * memory as a whole and its pages are accessed without system calls.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
    * @return error code. 0 if no error
@@ -37,9 +58,56 @@ class PageFile {
 
   /**
    * close the file.
+   * all dirty pages of the file are written to the disk first.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * write all dirty pages of the file to the disk in the order of pid.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * read n consecutive pages starting at startPid into the buffer.
+   * pages that are not cached are read with one vectored read per run
+   * and are kept in the cache.
+   * @param startPid[IN] the first page to read
+   * @param n[IN] the number of pages to read
+   * @param buffer[OUT] memory buffer of at least n * pageSize() bytes
+   * @return error code. 0 if no error
+   */
+  RC readRange(PageId startPid, int n, void* buffer) const;
+
+  /**
+   * write n consecutive pages starting at startPid from the buffer.
+   * in write-through mode the pages are written with a single system call.
+   * @param startPid[IN] the first page to write
+   * @param n[IN] the number of pages to write
+   * @param buffer[IN] memory buffer of n * pageSize() bytes
+   * @return error code. 0 if no error
+   */
+  RC writeRange(PageId startPid, int n, const void* buffer);
+
+  /**
+   * load up to n consecutive pages starting at startPid into the cache,
+   * so that the following read()s and pin()s of the pages hit the cache.
+   * nothing is done if page startPid is already cached, so a sequential
+   * reader can call this for every page it visits. at most half of the
+   * cache is used, and pages past endPid() are ignored.
+   * @param startPid[IN] the first page to load
+   * @param n[IN] the number of pages to load
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId startPid, int n) const;
+
+  /**
+   * tell the OS how the pages of the file are going to be accessed.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(AccessPattern pattern) const;
   
   /**
    * read a disk page into memory buffer.
@@ -48,11 +116,29 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * pin a disk page in the cache and return a pointer to the cached copy.
+   * the page can be read in place through the pointer until it is unpinned.
+   * every successful pin() must be matched by an unpin().
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the cached page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, const char*& page) const;
+
+  /**
+   * release a page pinned by pin().
+   * @param page[IN] the pointer returned by pin()
+   */
+  void unpin(const char* page) const;
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * in write-back mode, the page is only updated in the cache and
+   * reaches the disk when it is evicted or when the file is flushed.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
@@ -66,6 +152,30 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the size of the pages of the file in bytes
+   */
+  int pageSize() const { return psize; }
+
+  /**
+   * @return true if the file was opened in 'r' mode
+   */
+  bool isReadOnly() const { return readOnly; }
+
+  /**
+   * @return the format tag kept in the header page of the file.
+   *         0 if it was never set or the file has no header
+   */
+  int getFormat() const { return format; }
+
+  /**
+   * keep a tag in the header page of the file that tells its user
+   * how the pages are formatted. PageFile itself does not look at it.
+   * @param format[IN] the format tag
+   * @return error code. 0 if no error
+   */
+  RC setFormat(int format);
+
   /**
    * @return the total # of disk reads
    */
@@ -76,37 +186,252 @@ class PageFile {
    */
   static int getPageWriteCount() { return writeCount; }
 
+  /**
+   * @return the total # of page reads served from the buffer pool
+   */
+  static int getCacheHitCount()  { return bufferPool.getHitCount(); }
+
+  /**
+   * @return the total # of page reads that missed the buffer pool
+   */
+  static int getCacheMissCount() { return bufferPool.getMissCount(); }
+
+  /**
+   * @return the # of page reads served from the buffer pool while
+   *         the replacement policy was in use
+   */
+  static int getCacheHitCount(BufferPool::Policy policy)  { return bufferPool.getHitCount(policy); }
+
+  /**
+   * @return the # of page reads that missed the buffer pool while
+   *         the replacement policy was in use
+   */
+  static int getCacheMissCount(BufferPool::Policy policy) { return bufferPool.getMissCount(policy); }
+
+  /**
+   * set the size of the buffer pool shared by all PageFiles in pages.
+   * all cached pages are dropped.
+   * @param pages[IN] the number of pages the pool can hold
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSize(int pages);
+
+  /**
+   * set the size of the buffer pool shared by all PageFiles in megabytes.
+   * a frame of the pool is as large as the default page size, or as the
+   * largest page of the files opened so far if that is larger, so small
+   * pages let the pool hold more of them. the pool keeps its size in MB
+   * when the frame size changes.
+   * all cached pages are dropped.
+   * @param mb[IN] the size of the pool in MB
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSizeMB(int mb);
+
+  /**
+   * @return the number of pages the buffer pool can hold
+   */
+  static int getCacheSize() { return bufferPool.size(); }
+
+  /**
+   * set the replacement policy of the buffer pool shared by all PageFiles.
+   * all cached pages are dropped.
+   * @param policy[IN] BufferPool::LRU, BufferPool::CLOCK or BufferPool::TWO_Q
+   * @return error code. 0 if no error
+   */
+  static RC setReplacementPolicy(BufferPool::Policy policy) { return bufferPool.setPolicy(policy); }
+
+  /**
+   * @return the replacement policy of the buffer pool
+   */
+  static BufferPool::Policy getReplacementPolicy() { return bufferPool.getPolicy(); }
+
+  /**
+   * turn write-back caching on or off for all PageFiles.
+   * write-back is on by default. turning it off flushes all dirty pages.
+   * @param on[IN] true for write-back, false for write-through
+   * @return error code. 0 if no error
+   */
+  static RC setWriteBack(bool on);
+
+  /**
+   * @return true if write-back caching is on
+   */
+  static bool getWriteBack() { return writeBack; }
+
+  /**
+   * turn memory mapping of read-only files on or off.
+   * the setting applies to files opened after the call.
+   * pages of a mapped file bypass the buffer pool and are not counted
+   * in the page read count.
+   * @param on[IN] true to map files opened in 'r' mode
+   */
+  static void setMemoryMapped(bool on) { memoryMapped = on; }
+
+  /**
+   * set the page size of the files created after the call.
+   * existing files keep the page size they were created with.
+   * the frames of the buffer pool are resized to the new page size,
+   * unless a file with larger pages has been opened.
+   * @param size[IN] the page size in bytes. a power of two between
+   *                 PAGE_SIZE and MAX_PAGE_SIZE
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * @return the page size of new files in bytes
+   */
+  static int getDefaultPageSize() { return defaultPageSize; }
+
+  /**
+   * set the # pages loaded ahead of a sequential reader of a read-only file.
+   * the window is further limited to a quarter of the cache and MAX_IO_PAGES.
+   * @param pages[IN] the read-ahead window in pages. 0 turns read-ahead off
+   * @return error code. 0 if no error
+   */
+  static RC setReadAhead(int pages);
+
+  /**
+   * @return the read-ahead window in pages (0 if read-ahead is off)
+   */
+  static int getReadAhead() { return readAheadPages; }
+
  protected:
   /**
-   * move the file cursor to the beginning of a page.
+   * write the buffer to the disk page, bypassing the cache.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] page to write to
+   * @param buffer[IN] the content to write
+   * @return error code. 0 if no error
+   */
+  RC writePage(PageId pid, const void* buffer) const;
+
+  /**
+   * write n buffers to the consecutive disk pages starting at pid
+   * with a single vectored write, bypassing the cache.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the first page to write to
+   * @param buffers[IN] the contents of the pages
+   * @param n[IN] the number of pages (at most MAX_IO_PAGES)
+   * @return error code. 0 if no error
+   */
+  RC writePages(PageId pid, char* const* buffers, int n) const;
+
+  /**
+   * read pages [startPid, startPid + n) into the cache and optionally
+   * copy them to the buffer. runs of uncached pages are read with preadv.
    * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * @param startPid[IN] the first page to read
+   * @param n[IN] the number of pages to read
+   * @param buffer[OUT] memory buffer to copy the pages to. may be NULL
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC load(PageId startPid, int n, char* buffer) const;
+
+  /**
+   * get the cached frame of a page, reading it from the disk on a miss.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the page to fetch
+   * @param frame[OUT] the cache frame holding the page
+   * @return error code. 0 if no error
+   */
+  RC fetch(PageId pid, char*& frame) const;
+
+  /**
+   * track the pages read from the file and request the next run of pages
+   * from the read-ahead thread once the reader is found to be sequential.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the page being read
+   */
+  void noteAccess(PageId pid) const;
+
+  /**
+   * advance the sequential run state by a read of page pid.
+   * the caller must hold accessMutex.
+   * this is an internal function not exposed to public.
+   * @param pid[IN] the page being read
+   * @param startPid[OUT] the first page to read ahead
+   * @return the # pages to read ahead from startPid. 0 if none
+   */
+  int nextWindow(PageId pid, PageId& startPid) const;
+
+  /**
+   * read pages [startPid, startPid + n) with a single system call and
+   * put the ones not in the cache yet into the cache.
+   * called by the read-ahead thread.
+   * this is an internal function not exposed to public.
+   * @param startPid[IN] the first page to load
+   * @param n[IN] the number of pages to load (at most MAX_IO_PAGES)
+   * @return error code. 0 if no error
+   */
+  RC loadAhead(PageId startPid, int n) const;
+
+  /**
+   * set the page size of the file just opened from its header page,
+   * writing the header first if the file is new.
+   * this is an internal function not exposed to public.
+   * @param fileSize[IN] the size of the unix file in bytes
+   * @return error code. 0 if no error
+   */
+  RC readHeader(off_t fileSize);
+
+  /**
+   * find the id of the pages of the file in the buffer pool.
+   * a file opened for reading gets the id it had when it was last read,
+   * as long as it has not changed since, so that its cached pages are
+   * used again. any other file gets a new id.
+   * this is an internal function not exposed to public.
+   * @param st[IN] the status of the file just opened
+   * @param reuse[IN] true if the file is opened for reading
+   * @return the id of the file
+   */
+  static int fileId(const struct stat& st, bool reuse);
+
+  /**
+   * make the frames of the buffer pool as large as the larger of the
+   * default page size and the largest page of the files opened so far.
+   * all cached pages are dropped if the frame size changes.
+   * this is an internal function not exposed to public.
+   * @param pageSize[IN] the page size of a file being opened, or 0
+   * @return error code. 0 if no error
+   */
+  static RC fitFrames(int pageSize);
+
+  /**
+   * @param pid[IN] a page id
+   * @return the offset of the page in the unix file
+   */
+  off_t offsetOf(PageId pid) const { return (off_t) (pid + base) * psize; }
 
  private:
   int     fd;     // file descriptor of the associated unix file
+  int     fid;    // the id of the pages of the file in the buffer pool
   PageId  epid;   // (last page id + 1) of the file
+  bool    readOnly; // the file was opened in 'r' mode
+  char*   map;    // the memory-mapped file content (NULL if not mapped)
+  int     psize;  // the page size of the file in bytes
+  int     base;   // # header pages in front of page 0 (0 for old files)
+  int     format; // the format tag kept in the header page
+
+  mutable PageId lastPid;  // the page read last
+  mutable int    seqSteps; // # consecutive steps to the next page so far
+  mutable PageId aheadPid; // the first page not requested for read-ahead yet
+  mutable pthread_mutex_t accessMutex; // guards the three above among concurrent readers
 
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
+  // the LRU page cache shared by all PageFiles
+  static BufferPool bufferPool;
 
-  static int cacheClock; // clock tick counter for LRU policy
+  static bool writeBack; // keep written pages dirty in the cache
+  static bool memoryMapped; // map read-only files into memory
+  static int  defaultPageSize; // the page size of new files
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  // the background thread loading pages ahead of sequential readers
+  static ReadAhead readAhead;
+  static int readAheadPages; // the read-ahead window in pages
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static int readCount;  // total # of page reads, updated atomically
+  static int writeCount; // total # of page writes, updated atomically
 };
   
 #endif // PAGEFILE_H
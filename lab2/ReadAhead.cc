@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "ReadAhead.h"
+#include "PageFile.h"
+
+ReadAhead::ReadAhead()
+{
+  head = 0;
+  count = 0;
+  active.file = NULL;
+  started = false;
+  stopping = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&ready, NULL);
+  pthread_cond_init(&done, NULL);
+}
+
+ReadAhead::~ReadAhead()
+{
+  // let the thread finish its current request and exit
+  if (started) {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    count = 0;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+  }
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&ready);
+  pthread_mutex_destroy(&mutex);
+}
+
+void ReadAhead::request(const PageFile* file, PageId startPid, int n)
+{
+  if (n <= 0) return;
+
+  pthread_mutex_lock(&mutex);
+
+  // start the thread on demand. without it, read-ahead is simply off
+  if (!started && !stopping) {
+    if (pthread_create(&thread, NULL, run, this) == 0) started = true;
+    else stopping = true;
+  }
+
+  if (started && !stopping && count < MAX_PENDING) {
+    Request& r = queue[(head + count++) % MAX_PENDING];
+    r.file = file;
+    r.startPid = startPid;
+    r.n = n;
+    pthread_cond_signal(&ready);
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+bool ReadAhead::covers(const PageFile* file, PageId pid) const
+{
+  if (active.file == file && pid >= active.startPid && pid < active.startPid + active.n) {
+    return true;
+  }
+  for (int i = 0; i < count; i++) {
+    const Request& r = queue[(head + i) % MAX_PENDING];
+    if (r.file == file && pid >= r.startPid && pid < r.startPid + r.n) return true;
+  }
+  return false;
+}
+
+bool ReadAhead::wait(const PageFile* file, PageId pid)
+{
+  bool waited = false;
+
+  pthread_mutex_lock(&mutex);
+  while (covers(file, pid)) {
+    pthread_cond_wait(&done, &mutex);
+    waited = true;
+  }
+  pthread_mutex_unlock(&mutex);
+
+  return waited;
+}
+
+void ReadAhead::cancel(const PageFile* file)
+{
+  int kept = 0;
+
+  pthread_mutex_lock(&mutex);
+
+  // compact the queue, dropping the requests of the file
+  for (int i = 0; i < count; i++) {
+    const Request& r = queue[(head + i) % MAX_PENDING];
+    if (r.file != file) queue[(head + kept++) % MAX_PENDING] = r;
+  }
+  count = kept;
+
+  // the running request still uses the file descriptor
+  while (active.file == file) pthread_cond_wait(&done, &mutex);
+
+  pthread_mutex_unlock(&mutex);
+}
+
+void ReadAhead::serve()
+{
+  pthread_mutex_lock(&mutex);
+  for (;;) {
+    while (count == 0 && !stopping) pthread_cond_wait(&ready, &mutex);
+    if (stopping) break;
+
+    // take the oldest request
+    active = queue[head];
+    head = (head + 1) % MAX_PENDING;
+    count--;
+
+    // the I/O is done without holding the queue lock
+    pthread_mutex_unlock(&mutex);
+    active.file->loadAhead(active.startPid, active.n);
+    pthread_mutex_lock(&mutex);
+
+    active.file = NULL;
+    pthread_cond_broadcast(&done);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void* ReadAhead::run(void* arg)
+{
+  ((ReadAhead*) arg)->serve();
+  return NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <pthread.h>
+#include "Bruinbase.h"
+
+typedef int PageId;
+
+class PageFile;
+
+/**
+ * a background thread that loads runs of pages into the buffer pool
+ * ahead of a sequential reader.
+ * requests are served in FIFO order. a request is only a hint: it is
+ * dropped when the queue is full, and it never fails the reader.
+ */
+class ReadAhead {
+ public:
+  static const int MAX_PENDING = 8;  // max # requests waiting in the queue
+
+  ReadAhead();
+  ~ReadAhead();
+
+  /**
+   * ask the thread to load pages [startPid, startPid + n) of the file.
+   * the thread is started on the first request.
+   * @param file[IN] the file to read the pages from
+   * @param startPid[IN] the first page to load
+   * @param n[IN] the number of pages to load (at most MAX_IO_PAGES)
+   */
+  void request(const PageFile* file, PageId startPid, int n);
+
+  /**
+   * wait until no queued or running request of the file covers page pid,
+   * so that the caller can find the page in the cache instead of reading it.
+   * @param file[IN] the file of the page
+   * @param pid[IN] the page id
+   * @return true if the caller had to wait
+   */
+  bool wait(const PageFile* file, PageId pid);
+
+  /**
+   * drop the queued requests of the file and wait for the running one.
+   * this must be done before the file descriptor of the file is closed.
+   * @param file[IN] the file whose requests are cancelled
+   */
+  void cancel(const PageFile* file);
+
+ private:
+  struct Request {
+    const PageFile* file;  // the file to read from
+    PageId startPid;       // the first page of the run
+    int    n;              // the number of pages in the run
+  };
+
+  Request queue[MAX_PENDING];  // circular queue of pending requests
+  int     head;                // position of the oldest request
+  int     count;               // # requests in the queue
+  Request active;              // the request being served (file is NULL if none)
+
+  bool      started;     // the thread is running
+  bool      stopping;    // the thread was asked to exit
+  pthread_t thread;
+  pthread_mutex_t mutex; // guards all of the above
+  pthread_cond_t  ready; // signaled when a request is queued
+  pthread_cond_t  done;  // signaled when a request is finished
+
+  bool covers(const PageFile* file, PageId pid) const;
+  void serve();
+  static void* run(void* arg);
+
+  // not copyable
+  ReadAhead(const ReadAhead&);
+  ReadAhead& operator=(const ReadAhead&);
+};
+
+#endif // READAHEAD_H
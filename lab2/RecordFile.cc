@@ -7,11 +7,17 @@
  * @date 3/24/2008
  */
 
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "RecordFile.h"
 
 using std::string;
 
+static const int ZONE_MAGIC = 0x4d5a5242;  // "BRZM", the start of a zone file
+
 //
 // helper functions for page manipultation
 //
@@ -22,9 +28,22 @@ static char* slotPtr(char* page, int n);
 // read the record in the n'th slot in the page
 static void readSlot(const char* page, int n, int& key, std::string& value);
 
+// locate the value of the n'th slot in the page
+static void locateSlot(const char* page, int n, int& key, const char*& value, int& length);
+
 // write the record to the n'th slot in the page
 static void writeSlot(char* page, int n, int key, const std::string& value);
 
+// read the n'th record in a page of FORMAT_SLOTTED
+static void readSlotted(const char* page, int n, int& key, std::string& value);
+
+// locate the value of the n'th record in a page of FORMAT_SLOTTED
+static void locateSlotted(const char* page, int n, int& key, const char*& value, int& length);
+
+// write the record as the n'th record in a page of FORMAT_SLOTTED.
+// return false if it does not fit in the page
+static bool writeSlotted(char* page, int pageSize, int n, int key, const std::string& value);
+
 // get # records stored in the page
 static int getRecordCount(const char* page);
 
@@ -102,24 +121,74 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 }
 
 
+int RecordFile::defaultFormat = RecordFile::DEFAULT_FORMAT;
+
+RC RecordFile::setDefaultFormat(int format)
+{
+  if (format != FORMAT_FIXED && format != FORMAT_SLOTTED) return RC_INVALID_FILE_FORMAT;
+  defaultFormat = format;
+  return 0;
+}
+
 RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  slotsPerPage = RECORDS_PER_PAGE;
+  format = FORMAT_FIXED;
+  tailPid = -1;
+  tailDirty = false;
+  countPid = -1;
+  zonesChanged = false;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  slotsPerPage = RECORDS_PER_PAGE;
+  format = FORMAT_FIXED;
+  tailPid = -1;
+  tailDirty = false;
+  countPid = -1;
+  zonesChanged = false;
   open(filename, mode);
 }
 
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  char page[PageFile::MAX_PAGE_SIZE];
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  // a new file gets the default format. the others keep theirs
+  if (!pf.isReadOnly() && pf.endPid() == 0 && pf.getFormat() != defaultFormat) {
+    rc = pf.setFormat(defaultFormat);
+    if (rc < 0 && rc != RC_INVALID_FILE_FORMAT) { pf.close(); return rc; }
+  }
+  format = pf.getFormat();
+  if (format != FORMAT_FIXED && format != FORMAT_SLOTTED) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // the number of slots in a page depends on the page size of the file.
+  // a slotted page holds the most records when the values are empty
+  if (format == FORMAT_SLOTTED) {
+    slotsPerPage = (pf.pageSize() - sizeof(int)) / (sizeof(int) + 2 * sizeof(unsigned short));
+  } else {
+    slotsPerPage = (pf.pageSize() - sizeof(int)) / (sizeof(int) + MAX_VALUE_LENGTH);
+  }
+
+  // nothing is appended yet
+  tailPid = -1;
+  tailDirty = false;
+  countPid = -1;
+
+  // the zone map is kept next to the file
+  zoneFile = filename + ".zone";
+  zones.clear();
+  zonesChanged = false;
   
   //
   // in the rest of this function, we set the end record id
@@ -129,9 +198,11 @@ RC RecordFile::open(const string& filename, char mode)
   erid.pid = pf.endPid();
 
   // if the end pid is zero, the file is empty.
-  // set the end record id to (0, 0).
+  // set the end record id to (0, 0). a zone file left from
+  // an earlier file of the same name is not for this one
   if (erid.pid == 0) {
     erid.sid = 0;
+    if (!pf.isReadOnly()) unlink(zoneFile.c_str());
     return 0;
   }
 
@@ -145,74 +216,333 @@ RC RecordFile::open(const string& filename, char mode)
     return rc;
   }
 
-  // get # records in the last page
+  // get # records in the last page. whether another record fits
+  // in a slotted page depends on its length, so append() finds out
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  if (format == FORMAT_FIXED && erid.sid >= slotsPerPage) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
   }
+
+  // load the zone map. a writer rebuilds a missing or outdated one,
+  // so that the pages it appends extend a complete map
+  loadZones();
+  if (!pf.isReadOnly() && (PageId) zones.size() < erid.pid + (erid.sid > 0 ? 1 : 0)) {
+    buildZones();
+  }
   
   return 0;
 }
 
 RC RecordFile::close()
 {
+  RC rc, rc2;
+
+  // write the records still kept in memory and then their zones
+  rc = flush();
+  if (rc == 0 && zonesChanged) rc = saveZones();
+  tailPid = -1;
+  tailDirty = false;
+  countPid = -1;
+  zones.clear();
+  zonesChanged = false;
+
   erid.pid = 0;
   erid.sid = 0;
 
-  return pf.close();
+  rc2 = pf.close();
+  return (rc < 0) ? rc : rc2;
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  const char* page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= slotsPerPage) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // a record appended to the page kept in memory is read from there
+  if (rid.pid == tailPid) return readRecord(tail, rid.sid, key, value);
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  // pin the page containing the record
+  if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
+
+  // read the record from the slot in the cached page
+  rc = readRecord(page, rid.sid, key, value);
+  pf.unpin(page);
+
+  return rc;
+}
+
+RC RecordFile::read(const RecordId& rid, int& key, const char*& value, int& length,
+                     RecordPage& pinned) const
+{
+  RC rc;
+
+  // check whether the rid is in the valid range
+  if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= slotsPerPage) return RC_INVALID_RID;
+  if (rid >= erid) return RC_INVALID_RID;
+
+  // pin the page of the record unless it is already pinned.
+  // the page kept in memory needs no pin
+  if (pinned.page == NULL || pinned.pid != rid.pid) {
+    release(pinned);
+    if (rid.pid == tailPid) {
+      pinned.page = tail;
+    } else if ((rc = pf.pin(rid.pid, pinned.page)) < 0) {
+      pinned.page = NULL;
+      return rc;
+    }
+    pinned.pid = rid.pid;
+  }
+
+  // locate the record in the pinned page
+  if (format == FORMAT_FIXED) {
+    locateSlot(pinned.page, rid.sid, key, value, length);
+    return 0;
+  }
+  if (rid.sid >= getRecordCount(pinned.page)) return RC_INVALID_RID;
+  locateSlotted(pinned.page, rid.sid, key, value, length);
 
   return 0;
 }
 
+void RecordFile::release(RecordPage& pinned) const
+{
+  if (pinned.page != NULL && pinned.page != tail) pf.unpin(pinned.page);
+  pinned.page = NULL;
+  pinned.pid = -1;
+}
+
+RC RecordFile::readBatch(const RecordId rids[], int n, int keys[], string values[]) const
+{
+  RC   rc;
+  const char* page = NULL;
+  PageId pid = -1;
+
+  for (int i = 0; i < n; i++) {
+    const RecordId& rid = rids[i];
+
+    // check whether the rid is in the valid range
+    if (rid.pid < 0 || rid.pid > erid.pid || rid.sid < 0 || rid.sid >= slotsPerPage
+        || rid >= erid) {
+      rc = RC_INVALID_RID;
+      goto exit;
+    }
+
+    // the page kept in memory is read from there
+    if (rid.pid == tailPid) {
+      if ((rc = readRecord(tail, rid.sid, keys[i], values[i])) < 0) goto exit;
+      continue;
+    }
+
+    // pin the page of the record unless it is already pinned
+    if (rid.pid != pid) {
+      if (page != NULL) pf.unpin(page);
+      page = NULL;
+      if ((rc = pf.pin(rid.pid, page)) < 0) goto exit;
+      pid = rid.pid;
+    }
+
+    if ((rc = readRecord(page, rid.sid, keys[i], values[i])) < 0) goto exit;
+  }
+  rc = 0;
+
+ exit:
+  if (page != NULL) pf.unpin(page);
+  return rc;
+}
+
+RC RecordFile::readPages(PageId pid, int n, int keys[], string values[], int& count) const
+{
+  RC    rc;
+  char* buffer;
+  int   size = pf.pageSize();
+
+  // an empty range only needs its bounds checked
+  count = 0;
+  if (n <= 0) return loadPages(pid, n, NULL);
+
+  // read the whole range at once
+  if ((buffer = (char*) malloc((size_t) n * size)) == NULL) return RC_FILE_READ_FAILED;
+  if ((rc = loadPages(pid, n, buffer)) < 0) {
+    free(buffer);
+    return rc;
+  }
+
+  for (int i = 0; i < n && pid + i <= erid.pid; i++) {
+    const char* page = buffer + (size_t) i * size;
+    int slots = pageRecords(pid + i, page);
+    for (int sid = 0; sid < slots; sid++, count++) {
+      readRecord(page, sid, keys[count], values[count]);
+    }
+  }
+
+  free(buffer);
+  return 0;
+}
+
+RC RecordFile::readColumns(PageId pid, int n, char* buffer, int keys[],
+                           const char* values[], int lengths[], int& count) const
+{
+  RC  rc;
+  int size = pf.pageSize();
+
+  count = 0;
+  if ((rc = loadPages(pid, n, buffer)) < 0) return rc;
+
+  // locate the key and the value of each record in place
+  for (int i = 0; i < n && pid + i <= erid.pid; i++) {
+    const char* page = buffer + (size_t) i * size;
+    int slots = pageRecords(pid + i, page);
+    if (format == FORMAT_SLOTTED) {
+      for (int sid = 0; sid < slots; sid++, count++) {
+        locateSlotted(page, sid, keys[count], values[count], lengths[count]);
+      }
+    } else {
+      for (int sid = 0; sid < slots; sid++, count++) {
+        locateSlot(page, sid, keys[count], values[count], lengths[count]);
+      }
+    }
+  }
+
+  return 0;
+}
+
+RC RecordFile::loadPages(PageId pid, int n, char* buffer) const
+{
+  RC  rc;
+  int size = pf.pageSize();
+  int stored;
+
+  // the page kept in memory may not be in the file yet
+  PageId epid = (tailPid >= pf.endPid()) ? tailPid + 1 : pf.endPid();
+
+  if (pid < 0 || n < 0 || pid + n > epid) return RC_INVALID_PID;
+  if (n == 0) return 0;
+
+  // read the whole range at once
+  stored = (pid + n > pf.endPid()) ? pf.endPid() - pid : n;
+  if (stored > 0 && (rc = pf.readRange(pid, stored, buffer)) < 0) return rc;
+  if (tailPid >= pid && tailPid < pid + n) {
+    memcpy(buffer + (size_t) (tailPid - pid) * size, tail, size);
+  }
+
+  return 0;
+}
+
+int RecordFile::pageRecords(PageId pid, const char* page) const
+{
+  // every fixed page before the end record id is full.
+  // a slotted page knows its # records
+  if (format == FORMAT_SLOTTED) {
+    int slots = getRecordCount(page);
+    return (slots > slotsPerPage) ? slotsPerPage : slots;
+  }
+  return (pid < erid.pid) ? slotsPerPage : erid.sid;
+}
+
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
 
-  // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
-  if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
-  } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+  if (pf.isReadOnly()) return RC_FILE_WRITE_FAILED;
+
+  // the last page is kept in memory until it is full
+  if (tailPid != erid.pid) {
+    // unless we are writing to the the first slot of an empty page,
+    // we have to read the page first
+    if (erid.sid > 0) {
+      if ((rc = pf.read(erid.pid, tail)) < 0) return rc;
+    } else {
+      // if this is the first slot of an empty page
+      // we can simply initialize the page with zeros
+      memset(tail, 0, pf.pageSize());
+    }
+    tailPid = erid.pid;
   }
     
   // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
+  if (format == FORMAT_FIXED) {
+    writeSlot(tail, erid.sid, key, value);
+  } else if (!writeSlotted(tail, pf.pageSize(), erid.sid, key, value)) {
+    // the record does not fit in the rest of the slotted page.
+    // write the page to the disk and continue on a new one
+    if ((rc = flush()) < 0) return rc;
+    erid.pid++;
+    erid.sid = 0;
+    memset(tail, 0, pf.pageSize());
+    tailPid = erid.pid;
+    writeSlotted(tail, pf.pageSize(), erid.sid, key, value);
+  }
 
   // the first four bytes in the page stores # records in the page.
   // update this number.
-  setRecordCount(page, erid.sid + 1);
-
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  setRecordCount(tail, erid.sid + 1);
+  tailDirty = true;
+
+  // write a fixed page to the disk once it is full
+  if (format == FORMAT_FIXED && erid.sid + 1 >= slotsPerPage) {
+    if ((rc = flush()) < 0) {
+      // the record is not stored
+      setRecordCount(tail, erid.sid);
+      return rc;
+    }
+    tailPid = -1;
+  }
     
   // we need to output the rid of the record slot
   rid = erid;
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  // keep the smallest and the largest key of the page.
+  // pages without a zone may hold any key
+  while ((PageId) zones.size() < rid.pid) {
+    Zone any = { INT_MIN, INT_MAX };
+    zones.push_back(any);
+  }
+  if ((PageId) zones.size() == rid.pid) {
+    Zone zone = { key, key };
+    zones.push_back(zone);
+  } else {
+    if (key < zones[rid.pid].minKey) zones[rid.pid].minKey = key;
+    if (key > zones[rid.pid].maxKey) zones[rid.pid].maxKey = key;
+  }
+  zonesChanged = true;
+
+  // advance the end record id by one to the next empty slot.
+  // a slotted page is left once a record does not fit
+  if (format == FORMAT_FIXED) advance(erid);
+  else erid.sid++;
+
+  return 0;
+}
+
+RC RecordFile::appendBatch(const int keys[], const string values[], int n, RecordId rids[])
+{
+  RC rc;
+
+  // the records fill the page kept in memory, which is written once full
+  for (int i = 0; i < n; i++) {
+    if ((rc = append(keys[i], values[i], rids[i])) < 0) return rc;
+  }
+
+  return 0;
+}
+
+RC RecordFile::flush()
+{
+  RC rc;
+
+  if (!tailDirty) return 0;
+
+  // write the page to the disk
+  if ((rc = pf.write(tailPid, tail)) < 0) return rc;
+  tailDirty = false;
 
   return 0;
 }
@@ -222,6 +552,146 @@ const RecordId& RecordFile::endRid() const
   return erid;
 }
 
+void RecordFile::advance(RecordId& rid) const
+{
+  int slots = slotsPerPage;
+
+  // the # records of a slotted page depends on their lengths
+  if (format == FORMAT_SLOTTED) {
+    const char* page;
+    if (rid.pid == erid.pid) {
+      slots = erid.sid;
+    } else if (rid.pid == tailPid) {
+      slots = getRecordCount(tail);
+    } else if (rid.pid == countPid) {
+      slots = countSlots;
+    } else if (pf.pin(rid.pid, page) == 0) {
+      slots = countSlots = getRecordCount(page);
+      countPid = rid.pid;
+      pf.unpin(page);
+    }
+  }
+
+  // if the end of a page is reached, move to the next page
+  if (++rid.sid >= slots) {
+    rid.pid++;
+    rid.sid = 0;
+  }
+}
+
+RC RecordFile::prefetch(PageId pid, int n) const
+{
+  return pf.prefetch(pid, n);
+}
+
+RC RecordFile::advise(PageFile::AccessPattern pattern) const
+{
+  return pf.advise(pattern);
+}
+
+bool RecordFile::mayHoldKeys(PageId pid, int low, int high) const
+{
+  if (pid < 0 || pid >= (PageId) zones.size()) return true;
+  return zones[pid].minKey <= high && zones[pid].maxKey >= low;
+}
+
+int RecordFile::countPages(int low, int high) const
+{
+  int count = 0;
+  PageId pages = erid.pid + (erid.sid > 0 ? 1 : 0);
+
+  for (PageId pid = 0; pid < pages; pid++) {
+    if (mayHoldKeys(pid, low, high)) count++;
+  }
+
+  return count;
+}
+
+void RecordFile::loadZones()
+{
+  FILE* fp;
+  int   header[4];
+  PageId pages = erid.pid + (erid.sid > 0 ? 1 : 0);
+
+  zones.clear();
+  if ((fp = fopen(zoneFile.c_str(), "rb")) == NULL) return;
+
+  // the zone file starts with the end record id of the file it was saved for
+  // and the # zones
+  if (fread(header, sizeof(int), 4, fp) == 4 && header[0] == ZONE_MAGIC &&
+      header[1] == erid.pid && header[2] == erid.sid && header[3] == pages) {
+    zones.resize(pages);
+    if (pages > 0 && fread(&zones[0], sizeof(Zone), pages, fp) != (size_t) pages) {
+      zones.clear();
+    }
+  }
+
+  fclose(fp);
+}
+
+RC RecordFile::buildZones()
+{
+  RC rc;
+  int count;
+  PageId pages = erid.pid + (erid.sid > 0 ? 1 : 0);
+  std::vector<int> keys(slotsPerPage);
+  std::vector<string> values(slotsPerPage);
+
+  zones.clear();
+  for (PageId pid = 0; pid < pages; pid++) {
+    if ((rc = readPages(pid, 1, &keys[0], &values[0], count)) < 0) {
+      zones.clear();
+      return rc;
+    }
+
+    // an empty page holds no key at all
+    Zone zone = { INT_MAX, INT_MIN };
+    for (int i = 0; i < count; i++) {
+      if (keys[i] < zone.minKey) zone.minKey = keys[i];
+      if (keys[i] > zone.maxKey) zone.maxKey = keys[i];
+    }
+    zones.push_back(zone);
+  }
+  zonesChanged = true;
+
+  return 0;
+}
+
+RC RecordFile::saveZones()
+{
+  FILE* fp;
+  int   header[4] = { ZONE_MAGIC, erid.pid, erid.sid, (int) zones.size() };
+
+  if ((fp = fopen(zoneFile.c_str(), "wb")) == NULL) return RC_FILE_OPEN_FAILED;
+  if (fwrite(header, sizeof(int), 4, fp) != 4 ||
+      (!zones.empty() && fwrite(&zones[0], sizeof(Zone), zones.size(), fp) != zones.size())) {
+    fclose(fp);
+    unlink(zoneFile.c_str());
+    return RC_FILE_WRITE_FAILED;
+  }
+  if (fclose(fp) != 0) {
+    unlink(zoneFile.c_str());
+    return RC_FILE_WRITE_FAILED;
+  }
+  zonesChanged = false;
+
+  return 0;
+}
+
+RC RecordFile::readRecord(const char* page, int sid, int& key, string& value) const
+{
+  if (format == FORMAT_FIXED) {
+    readSlot(page, sid, key, value);
+    return 0;
+  }
+
+  // a slotted page may hold fewer records than slotsPerPage
+  if (sid >= getRecordCount(page)) return RC_INVALID_RID;
+  readSlotted(page, sid, key, value);
+
+  return 0;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -258,6 +728,17 @@ static void readSlot(const char* page, int n, int& key, std::string& value)
   value.assign(ptr + sizeof(int));
 }
 
+static void locateSlot(const char* page, int n, int& key, const char*& value, int& length)
+{
+  // compute the location of the record
+  const char *ptr = slotPtr(const_cast<char*>(page), n);
+
+  // read the key and locate the value
+  memcpy(&key, ptr, sizeof(int));
+  value = ptr + sizeof(int);
+  length = strlen(value);
+}
+
 static void writeSlot(char* page, int n, int key, const std::string& value)
 {
   // compute the location of the record
@@ -275,3 +756,63 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
     strcpy(ptr + sizeof(int), value.c_str());
   }
 }
+
+//
+// a page of FORMAT_SLOTTED holds # records (an int), then a directory
+// with the (offset, length) of each record as two unsigned shorts.
+// the records fill the page from its end backwards, each a key (an int)
+// followed by length bytes of the value without the null terminator.
+//
+
+static void readSlotted(const char* page, int n, int& key, std::string& value)
+{
+  const char* ptr;
+  int length;
+
+  locateSlotted(page, n, key, ptr, length);
+  value.assign(ptr, length);
+}
+
+static void locateSlotted(const char* page, int n, int& key, const char*& value, int& length)
+{
+  unsigned short entry[2];
+
+  // read the offset and length of the record from the directory
+  memcpy(entry, page + sizeof(int) + sizeof(entry) * n, sizeof(entry));
+
+  // read the key and locate the value
+  memcpy(&key, page + entry[0], sizeof(int));
+  value = page + entry[0] + sizeof(int);
+  length = entry[1];
+}
+
+static bool writeSlotted(char* page, int pageSize, int n, int key, const std::string& value)
+{
+  unsigned short entry[2];
+  int end;
+
+  // the value is truncated and ends at a null character as in a fixed slot
+  int length = strlen(value.c_str());
+  if (length >= RecordFile::MAX_VALUE_LENGTH) length = RecordFile::MAX_VALUE_LENGTH - 1;
+
+  // the record goes right before the previous one
+  if (n == 0) {
+    end = pageSize;
+  } else {
+    memcpy(entry, page + sizeof(int) + sizeof(entry) * (n - 1), sizeof(entry));
+    end = entry[0];
+  }
+
+  // the record and its directory entry must fit in the free space
+  int offset = end - (int) sizeof(int) - length;
+  if (offset < (int) (sizeof(int) + sizeof(entry) * (n + 1))) return false;
+
+  memcpy(page + offset, &key, sizeof(int));
+  memcpy(page + offset + sizeof(int), value.data(), length);
+
+  entry[0] = offset;
+  entry[1] = length;
+  memcpy(page + sizeof(int) + sizeof(entry) * n, entry, sizeof(entry));
+
+  return true;
+}
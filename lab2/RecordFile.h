@@ -11,6 +11,7 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -26,7 +27,8 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
+// RecordId iterators. they assume RECORDS_PER_PAGE slots per page;
+// use RecordFile::advance() for a file with a different page size
 RecordId& operator++ (RecordId& rid);
 RecordId  operator++ (RecordId& rid, int);
 
@@ -39,7 +41,19 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * a page of a RecordFile pinned by RecordFile::read() while the value
+ * located in it is in use. a page with pid -1 holds nothing.
+ */
+typedef struct {
+  PageId      pid;   // the page id
+  const char* page;  // the pinned page (NULL if none)
+} RecordPage;
+
+/**
+ * read/write a record to a file.
+ * the smallest and largest key of each page are kept in a zone map,
+ * saved in the side file <filename>.zone, so that scans of a key range
+ * can skip the pages that cannot hold a key of the range.
  */
 class RecordFile {
  public:
@@ -47,11 +61,16 @@ class RecordFile {
   // maximum length of the value field
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  // number of record slots per page of a file with 1KB pages
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
 
+  // formats of the pages of a file, kept in the header of the file
+  static const int FORMAT_FIXED = 0;    // a slot of sizeof(int) + MAX_VALUE_LENGTH bytes per record
+  static const int FORMAT_SLOTTED = 1;  // a slot directory and variable-length values
+  static const int DEFAULT_FORMAT = FORMAT_SLOTTED;  // the format of new files unless set
+
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
@@ -79,10 +98,75 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a record from the file without copying its value.
+   * the page of the record is pinned and the value is located in it.
+   * the page stays pinned in pinned, and is reused for the next record
+   * of the same page, until a record of another page is read or
+   * release() is called. the value is valid until then.
+   * @param rid[IN] the id of the record to read
+   * @param key[OUT] the record key
+   * @param value[OUT] the start of the record value, not null-terminated
+   * @param length[OUT] the length of the record value
+   * @param pinned[IN/OUT] the page pinned by the previous call ({-1, NULL} if none)
+   * @return error code. 0 if no error
+   */
+  RC read(const RecordId& rid, int& key, const char*& value, int& length,
+          RecordPage& pinned) const;
+
+  /**
+   * unpin the page pinned by read().
+   * @param pinned[IN/OUT] the pinned page. it holds nothing afterwards
+   */
+  void release(RecordPage& pinned) const;
+
+  /**
+   * read n records from the file. the page of consecutive rids with the
+   * same pid is looked up once, so rids sorted by pid read each page once.
+   * @param rids[IN] the ids of the records to read
+   * @param n[IN] the number of records
+   * @param keys[OUT] the record keys
+   * @param values[OUT] the record values
+   * @return error code. 0 if no error
+   */
+  RC readBatch(const RecordId rids[], int n, int keys[], std::string values[]) const;
+
+  /**
+   * read every record on the pages pid, pid + 1, ..., pid + n - 1 in
+   * RecordId order. the pages are read with as few system calls as possible,
+   * and several threads can read different pages of the file at once.
+   * @param pid[IN] the first page to read
+   * @param n[IN] the number of pages
+   * @param keys[OUT] the record keys (room for n * recordsPerPage() records)
+   * @param values[OUT] the record values (room for n * recordsPerPage() records)
+   * @param count[OUT] the number of records read
+   * @return error code. 0 if no error
+   */
+  RC readPages(PageId pid, int n, int keys[], std::string values[], int& count) const;
+
+  /**
+   * like readPages(), but the values are not copied: the pages are read
+   * into buffer and the value of each record is located in place.
+   * the values are not null-terminated and stay valid while buffer does.
+   * @param pid[IN] the first page to read
+   * @param n[IN] the number of pages
+   * @param buffer[IN] memory buffer of at least n * pageSize() bytes
+   * @param keys[OUT] the record keys (room for n * recordsPerPage() records)
+   * @param values[OUT] the start of each record value in buffer
+   * @param lengths[OUT] the length of each record value
+   * @param count[OUT] the number of records read
+   * @return error code. 0 if no error
+   */
+  RC readColumns(PageId pid, int n, char* buffer, int keys[],
+                 const char* values[], int lengths[], int& count) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
    * append is the only way to write a record to a RecordFile.
+   * the last page of the file is kept in memory while records are appended
+   * to it, and written once when it is full, or by flush() or close().
+   * the records can be read back before they are written.
    * @param key[IN] the record key
    * @param value[IN] the record value
    * @param rid[OUT] the location of the stored record
@@ -90,15 +174,153 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append n records at the end of the file, like n calls to append().
+   * @param keys[IN] the record keys
+   * @param values[IN] the record values
+   * @param n[IN] the number of records
+   * @param rids[OUT] the locations of the stored records
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(const int keys[], const std::string values[], int n, RecordId rids[]);
+
+  /**
+   * write the appended records that are still kept in memory to the file.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * @return the page size of the file in bytes
+   */
+  int pageSize() const { return pf.pageSize(); }
+
+  /**
+   * @return the max number of records in a page of the file
+   */
+  int recordsPerPage() const { return slotsPerPage; }
+
+  /**
+   * @return the format of the pages of the file (FORMAT_FIXED or FORMAT_SLOTTED)
+   */
+  int getFormat() const { return format; }
+
+  /**
+   * set the format of the files created from now on. a file keeps the
+   * format it was created with. files without a header, written before
+   * the format was kept, are in FORMAT_FIXED.
+   * @param format[IN] FORMAT_FIXED or FORMAT_SLOTTED
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultFormat(int format);
+  static int getDefaultFormat() { return defaultFormat; }
+
+  /**
+   * move the record id to the next slot of the file.
+   * in FORMAT_SLOTTED, this looks up the # records of the page of rid,
+   * so it must not be called by several threads at once.
+   * @param rid[IN/OUT] the record id to advance
+   */
+  void advance(RecordId& rid) const;
+
+  /**
+   * load the pages pid, pid + 1, ..., pid + n - 1 into the page cache
+   * with as few system calls as possible, unless page pid is already cached.
+   * @param pid[IN] the first page to load
+   * @param n[IN] the number of pages to load
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int n) const;
+
+  /**
+   * tell the OS how the records of the file are going to be accessed.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(PageFile::AccessPattern pattern) const;
+
+  /**
+   * check the zone map of page pid against the key range [low, high].
+   * a page without a zone (e.g. of a file appended before the zone map
+   * was kept) may hold any key.
+   * @param pid[IN] the page to check
+   * @param low[IN] the smallest key of the range
+   * @param high[IN] the largest key of the range
+   * @return false if page pid holds no key in [low, high]
+   */
+  bool mayHoldKeys(PageId pid, int low, int high) const;
+
+  /**
+   * @return the # pages of the file that may hold a key in [low, high]
+   */
+  int countPages(int low, int high) const;
+
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int slotsPerPage; // max # records per page, given the page size and format of the file
+  int format;       // the format of the pages (FORMAT_*)
+
+  static int defaultFormat;  // the format of new files
+
+  PageId tailPid;    // the page kept in tail while records are appended (-1 if none)
+  bool   tailDirty;  // tail holds records not written to the file yet
+  char   tail[PageFile::MAX_PAGE_SIZE];  // the last page of the file
+
+  // the smallest and the largest key on a page
+  struct Zone {
+    int minKey;
+    int maxKey;
+  };
+  std::vector<Zone> zones;   // the zone of each page, from page 0 (fewer if unknown)
+  bool zonesChanged;         // zones differs from the zone file
+  std::string zoneFile;      // the name of the zone file
+
+  mutable PageId countPid;    // the slotted page last looked up by advance()
+  mutable int    countSlots;  // and its # records. only the last page can grow
+
+  /**
+   * read the record in slot sid of a page of the file.
+   * @return error code. 0 if no error
+   */
+  RC readRecord(const char* page, int sid, int& key, std::string& value) const;
+
+  /**
+   * read the pages pid, ..., pid + n - 1 into buffer, including the page
+   * kept in memory.
+   * @return error code. 0 if no error
+   */
+  RC loadPages(PageId pid, int n, char* buffer) const;
+
+  /**
+   * @return the # records on page pid, read into page
+   */
+  int pageRecords(PageId pid, const char* page) const;
+
+  /**
+   * load the zone map from the zone file. a zone file written for other
+   * contents of the file, e.g. when it was appended without the zone map
+   * being saved, is ignored and the zone map is left empty.
+   */
+  void loadZones();
+
+  /**
+   * compute the zone map from the records of the file.
+   * @return error code. 0 if no error
+   */
+  RC buildZones();
+
+  /**
+   * write the zone map to the zone file.
+   * @return error code. 0 if no error
+   */
+  RC saveZones();
 };
 
 #endif // RECORDFILE_H
@@ -10,17 +10,56 @@
 #include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <pthread.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeNode.h"
 #include "BTreeIndex.h"
+#include "IndexSorter.h"
 
 using namespace std;
 
+// # index entries or tuples read or loaded at a time
+static const int BATCH_ENTRIES = 64;
+// max # index entries whose tuples are fetched in RecordId order together (1MB of rids)
+static const int RID_SORT_ENTRIES = 1 << 17;
+// fetch the tuples of a chunk in RecordId order if it has more entries than this
+static const int SORT_FETCH_MIN_ENTRIES = 64;
+// # table pages a scan thread reads at a time
+static const int MORSEL_PAGES = 32;
+// # morsels per thread an ordered scan may read ahead of the printed output
+static const int MORSEL_WINDOW = 4;
+
 // external functions and variables for load file and sql command parsing 
 extern FILE* sqlin;
 int sqlparse(void);
 
+thread_local string SqlEngine::lastPlan;
+int SqlEngine::scanThreads = 0;
+bool SqlEngine::scanOrdered = true;
+bool SqlEngine::scanBatches = true;
+
+const string& SqlEngine::getLastPlan()
+{
+  return lastPlan;
+}
+
+RC SqlEngine::setScanThreads(int n)
+{
+  if (n < 0) return RC_INVALID_THREAD_COUNT;
+  scanThreads = n;
+  return 0;
+}
+
 RC SqlEngine::run(FILE* commandline)
 {
   fprintf(stdout, "Bruinbase> ");
@@ -33,54 +72,453 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
-bool conditionRange(const vector<SelCond>& cond, int &low, int &high)
+/*
+ * Tests of the comparators of a value condition, given the comparison of the
+ * tuple value and the constant
+ */
+typedef bool (*ValueTest)(int diff);
+static bool valueEQ(int diff) { return diff == 0; }
+static bool valueNE(int diff) { return diff != 0; }
+static bool valueGT(int diff) { return diff > 0; }
+static bool valueLT(int diff) { return diff < 0; }
+static bool valueGE(int diff) { return diff >= 0; }
+static bool valueLE(int diff) { return diff <= 0; }
+
+/*
+ * The conditions of a select, compiled once per query.
+ * The key conditions other than NE narrow the key range [low, high], the NE
+ * conditions on the key become a list of excluded keys, and each value
+ * condition keeps its constant and the test of its comparator.
+ */
+struct Predicate {
+	int  low, high;        //the keys the conditions allow, low > high if none
+	bool checkRange;       //false once the keys are known to be in [low, high]
+	vector<int> excluded;  //the keys rejected by NE conditions
+	vector<const char*> constants;  //the constant of each value condition
+	vector<int>         lengths;    //its length
+	vector<ValueTest>   tests;      //and the test of its comparator
+	
+	Predicate(const vector<SelCond>& cond);
+	
+	//@return true if the key meets the key conditions
+	bool keyMatches(int key) const
+	{
+		if(checkRange && (key < low || key > high))
+			return false;
+		for(size_t i = 0; i < excluded.size(); i++){
+			if(key == excluded[i])
+				return false;
+		}
+		return true;
+	}
+	
+	//@return true if the value of length bytes, not null-terminated, meets the value conditions
+	bool valueMatches(const char* value, int length) const
+	{
+		for(size_t i = 0; i < tests.size(); i++){
+			int diff = memcmp(value, constants[i], min(length, lengths[i]));
+			if(diff == 0)
+				diff = length - lengths[i];
+			if(!tests[i](diff))
+				return false;
+		}
+		return true;
+	}
+	
+	//@return true if the tuple meets every condition
+	bool matches(int key, const char* value, int length) const
+	{
+		return keyMatches(key) && valueMatches(value, length);
+	}
+	
+	bool matches(int key, const string& value) const
+	{
+		return matches(key, value.data(), value.size());
+	}
+};
+
+Predicate::Predicate(const vector<SelCond>& cond)
 {
-	//Set low as lowest key value and highest key value possible
-	low = 1;
-	high = 2147483647;
-	for(int i = 0; i < cond.size(); i++){
-		int num = atoi(cond[i].value);
-		if(cond[i].attr == 1){
+	bool empty = false;
+	low = INT_MIN;
+	high = INT_MAX;
+	checkRange = true;
+	for(size_t i = 0; i < cond.size(); i++){
+		if(cond[i].attr == 2){
+			constants.push_back(cond[i].value);
+			lengths.push_back(strlen(cond[i].value));
 			switch(cond[i].comp){
-				case SelCond::EQ: 
-					if(low > num || high < num)
-						return false;
-					low = num;
-					high = num;
-					break;
-				case SelCond::NE:
-					break;
-				case SelCond::LT:
-					if(low > num)
-						return false;
-					if(high > num-1)
-						high = num-1;
-					break;
-				case SelCond::GT:
-					if(high < num)
-						return false;
-					if(low < num+1)
-						low = num+1;
+				case SelCond::EQ: tests.push_back(valueEQ); break;
+				case SelCond::NE: tests.push_back(valueNE); break;
+				case SelCond::GT: tests.push_back(valueGT); break;
+				case SelCond::LT: tests.push_back(valueLT); break;
+				case SelCond::GE: tests.push_back(valueGE); break;
+				case SelCond::LE: tests.push_back(valueLE); break;
+			}
+			continue;
+		}
+		int num = atoi(cond[i].value);
+		switch(cond[i].comp){
+			case SelCond::EQ:
+				low = max(low, num);
+				high = min(high, num);
+				break;
+			case SelCond::NE:
+				excluded.push_back(num);
+				break;
+			case SelCond::GT:
+				if(num == INT_MAX)
+					empty = true;
+				else
+					low = max(low, num + 1);
+				break;
+			case SelCond::LT:
+				if(num == INT_MIN)
+					empty = true;
+				else
+					high = min(high, num - 1);
+				break;
+			case SelCond::GE:
+				low = max(low, num);
+				break;
+			case SelCond::LE:
+				high = min(high, num);
+				break;
+		}
+	}
+	if(empty){
+		low = INT_MAX;
+		high = INT_MIN;
+	}
+}
+
+/*
+ * Select the rows of a batch that meet the conditions of the predicate.
+ * The keys are compared with the key range and the excluded keys a vector
+ * register at a time, which gives a bitmap of the rows left in the register.
+ * Only the rows left are compared on their values.
+ * @param sel[OUT] the positions of the selected rows, in order
+ * @return the # selected rows
+ */
+static int selectRows(const Predicate& pred, const int keys[], const char* const values[], const int lengths[], int n, int sel[])
+{
+	int low = pred.checkRange ? pred.low : INT_MIN;
+	int high = pred.checkRange ? pred.high : INT_MAX;
+	int m = 0, i = 0;
+#ifdef __AVX2__
+	const __m256i lo = _mm256_set1_epi32(low);
+	const __m256i hi = _mm256_set1_epi32(high);
+	for(; i + 8 <= n; i += 8){
+		__m256i block = _mm256_loadu_si256((const __m256i*)(keys + i));
+		__m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(lo, block), _mm256_cmpgt_epi32(block, hi));
+		for(size_t e = 0; e < pred.excluded.size(); e++)
+			out = _mm256_or_si256(out, _mm256_cmpeq_epi32(block, _mm256_set1_epi32(pred.excluded[e])));
+		unsigned bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+		for(; bits != 0; bits &= bits - 1)
+			sel[m++] = i + __builtin_ctz(bits);
+	}
+#elif defined(__SSE2__)
+	const __m128i lo = _mm_set1_epi32(low);
+	const __m128i hi = _mm_set1_epi32(high);
+	for(; i + 4 <= n; i += 4){
+		__m128i block = _mm_loadu_si128((const __m128i*)(keys + i));
+		__m128i out = _mm_or_si128(_mm_cmpgt_epi32(lo, block), _mm_cmpgt_epi32(block, hi));
+		for(size_t e = 0; e < pred.excluded.size(); e++)
+			out = _mm_or_si128(out, _mm_cmpeq_epi32(block, _mm_set1_epi32(pred.excluded[e])));
+		unsigned bits = ~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+		for(; bits != 0; bits &= bits - 1)
+			sel[m++] = i + __builtin_ctz(bits);
+	}
+#endif
+	//The rows past the last full register, or all of them without SIMD
+	for(; i < n; i++){
+		if(pred.keyMatches(keys[i]))
+			sel[m++] = i;
+	}
+	
+	if(pred.tests.empty())
+		return m;
+	int left = 0;
+	for(int j = 0; j < m; j++){
+		if(pred.valueMatches(values[sel[j]], lengths[sel[j]]))
+			sel[left++] = sel[j];
+	}
+	return left;
+}
+
+/*
+ * State shared by the threads of a parallel table scan.
+ * The pages of the table are split into morsels of MORSEL_PAGES pages
+ * that the threads claim in order.
+ */
+struct ParallelScan {
+	const RecordFile* rf;
+	const Predicate* pred;  //the conditions, pages outside of their key range are skipped
+	int    attr;
+	bool   ordered;     //print the tuples in table order
+	bool   batch;       //decode the pages into columns and select the rows with selectRows()
+	PageId endPid;      //# pages holding tuples
+	int    morsels;     //# morsels
+	int    window;      //max # morsels claimed past the first one not printed
+
+	pthread_mutex_t mutex;  //guards the fields below
+	pthread_cond_t  moved;  //signaled when a morsel is printed or a thread fails
+	int    next;        //the next morsel to claim
+	int    printed;     //# morsels printed, in order
+	vector<string> out; //the output of the morsels finished but not printed yet
+	vector<bool>   done;
+	int    count;       //# matching tuples
+	RC     rc;          //the first error of a thread
+};
+
+/*
+ * Claim morsels of the scan until none is left: read the tuples of the morsel,
+ * check the conditions, and print the matching tuples.
+ * A batch scan keeps the pages of the morsel and locates the values in them,
+ * so only the values of the matching tuples are copied, into the output.
+ * An unordered scan prints each morsel as soon as it is finished. An ordered one
+ * prints the finished morsels that follow the ones printed so far.
+ */
+static void* scanMorsels(void* arg)
+{
+	ParallelScan& scan = *(ParallelScan*)arg;
+	int     n = scan.rf->recordsPerPage() * MORSEL_PAGES;
+	int     size = scan.rf->pageSize();
+	int*    keys = new int[n];
+	string* values = scan.batch ? NULL : new string[n];
+	char*   pages = scan.batch ? new char[(size_t)size * MORSEL_PAGES] : NULL;
+	const char** ptrs = scan.batch ? new const char*[n] : NULL;
+	int*    lengths = scan.batch ? new int[n] : NULL;
+	int*    sel = scan.batch ? new int[n] : NULL;
+	string  out;
+	char    buf[32];
+	
+	for(;;){
+		//Claim the next morsel, but do not get too far ahead of the printed output
+		pthread_mutex_lock(&scan.mutex);
+		while(scan.ordered && scan.rc == 0 && scan.next < scan.morsels && scan.next >= scan.printed + scan.window)
+			pthread_cond_wait(&scan.moved, &scan.mutex);
+		int m = (scan.rc == 0 && scan.next < scan.morsels) ? scan.next++ : -1;
+		pthread_mutex_unlock(&scan.mutex);
+		if(m < 0)
+			break;
+		
+		//Read the runs of pages of the morsel that the zone map does not rule out
+		PageId first = m * MORSEL_PAGES;
+		PageId end = min(first + MORSEL_PAGES, scan.endPid);
+		int k = 0, count = 0;
+		RC rc = 0;
+		for(PageId pid = first; rc == 0 && pid < end; ){
+			if(!scan.rf->mayHoldKeys(pid, scan.pred->low, scan.pred->high)){
+				pid++;
+				continue;
+			}
+			PageId run = pid + 1;
+			while(run < end && scan.rf->mayHoldKeys(run, scan.pred->low, scan.pred->high))
+				run++;
+			int read;
+			if(scan.batch)
+				rc = scan.rf->readColumns(pid, run - pid, pages + (size_t)(pid - first) * size,
+					keys + k, ptrs + k, lengths + k, read);
+			else
+				rc = scan.rf->readPages(pid, run - pid, keys + k, values + k, read);
+			k += read;
+			pid = run;
+		}
+		
+		out.clear();
+		if(scan.batch && rc == 0){
+			//The rows are selected on the whole morsel, then only the matching ones are printed
+			count = selectRows(*scan.pred, keys, ptrs, lengths, k, sel);
+			for(int j = 0; j < count; j++){
+				int i = sel[j];
+				switch(scan.attr){
+					case 1:  // SELECT key
+						snprintf(buf, sizeof(buf), "%d\n", keys[i]);
+						out += buf;
+						break;
+					case 2:  // SELECT value
+						out.append(ptrs[i], lengths[i]);
+						out += '\n';
+						break;
+					case 3:  // SELECT *
+						snprintf(buf, sizeof(buf), "%d '", keys[i]);
+						out += buf;
+						out.append(ptrs[i], lengths[i]);
+						out += "'\n";
+						break;
+				}
+			}
+		}
+		for(int i = 0; !scan.batch && rc == 0 && i < k; i++){
+			if(!scan.pred->matches(keys[i], values[i]))
+				continue;
+			count++;
+			switch(scan.attr){
+				case 1:  // SELECT key
+					snprintf(buf, sizeof(buf), "%d\n", keys[i]);
+					out += buf;
 					break;
-				case SelCond::LE:
-					if(low > num)
-						return false;
-					if(high > num)
-						high = num;
+				case 2:  // SELECT value
+					out += values[i];
+					out += '\n';
 					break;
-				case SelCond::GE:
-					if(high < num)
-						return false;
-					if(low < num)
-						low = num;
+				case 3:  // SELECT *
+					snprintf(buf, sizeof(buf), "%d '", keys[i]);
+					out += buf;
+					out += values[i];
+					out += "'\n";
 					break;
 			}
-			//If two conditions contradict then return false
-			if(low > high)
-				return false;
 		}
+		
+		pthread_mutex_lock(&scan.mutex);
+		if(rc < 0){
+			if(scan.rc == 0)
+				scan.rc = rc;
+		}else if(!scan.ordered){
+			scan.count += count;
+			fwrite(out.data(), 1, out.size(), stdout);
+		}else{
+			scan.count += count;
+			scan.out[m].swap(out);
+			scan.done[m] = true;
+			while(scan.printed < scan.morsels && scan.done[scan.printed]){
+				string& o = scan.out[scan.printed++];
+				fwrite(o.data(), 1, o.size(), stdout);
+				string().swap(o);
+			}
+		}
+		pthread_cond_broadcast(&scan.moved);
+		pthread_mutex_unlock(&scan.mutex);
+	}
+	
+	delete [] keys;
+	delete [] values;
+	delete [] pages;
+	delete [] ptrs;
+	delete [] lengths;
+	delete [] sel;
+	return NULL;
+}
+
+/*
+ * Scan the table with threads threads, the calling thread being one of them.
+ * @param count[OUT] the # matching tuples
+ * @return error code. 0 if no error
+ */
+static RC parallelScan(const RecordFile& rf, const Predicate& pred, int attr, int threads, bool ordered, bool batch, int& count)
+{
+	ParallelScan scan;
+	vector<pthread_t> workers;
+	pthread_t worker;
+	
+	scan.rf = &rf;
+	scan.pred = &pred;
+	scan.attr = attr;
+	scan.ordered = ordered;
+	scan.batch = batch;
+	scan.endPid = rf.endRid().pid + (rf.endRid().sid > 0 ? 1 : 0);
+	scan.morsels = (scan.endPid + MORSEL_PAGES - 1) / MORSEL_PAGES;
+	scan.window = threads * MORSEL_WINDOW;
+	scan.next = 0;
+	scan.printed = 0;
+	scan.out.resize(ordered ? scan.morsels : 0);
+	scan.done.resize(ordered ? scan.morsels : 0);
+	scan.count = 0;
+	scan.rc = 0;
+	pthread_mutex_init(&scan.mutex, NULL);
+	pthread_cond_init(&scan.moved, NULL);
+	
+	//A thread that cannot be started leaves its share to the others
+	for(int i = 1; i < threads; i++){
+		if(pthread_create(&worker, NULL, scanMorsels, &scan) == 0)
+			workers.push_back(worker);
 	}
-	return true;
+	scanMorsels(&scan);
+	for(size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i], NULL);
+	
+	pthread_cond_destroy(&scan.moved);
+	pthread_mutex_destroy(&scan.mutex);
+	count = scan.count;
+	return scan.rc;
+}
+
+/*
+ * Decide whether reading the key range of the conditions through the index is
+ * estimated to be cheaper than scanning the table, and describe the chosen plan.
+ * Costs are counted in page reads: a scan reads every table page, the index
+ * path descends the tree, reads the leaves of the range and the table pages
+ * holding its tuples.
+ * The keys are assumed to be spread evenly between the smallest and the largest key.
+ * @param attr[IN] the attribute of the select
+ * @param indexOnly[IN] true if the index leaves alone answer the query
+ * @param plan[OUT] the description of the chosen plan
+ * @return true if the index should be used
+ */
+static bool chooseIndex(const BTreeIndex& tree, const RecordFile& rf, const Predicate& pred, int attr, bool indexOnly, string& plan)
+{
+	char buf[200];
+	int low = pred.low, high = pred.high;
+	bool fetch = !indexOnly;
+	//count(*) of a key range adds up the entry counts kept in the nonleaf nodes
+	bool counted = indexOnly && attr == 4 && tree.hasSubtreeSizes();
+	const char* how = counted ? "index range count" : (fetch ? "index scan" : "index-only scan");
+	
+	//Conflicting conditions select nothing, the index finds that out at once
+	if(low > high){
+		plan = string(how) + " of an empty key range";
+		return true;
+	}
+	if(!tree.hasStats()){
+		snprintf(buf, sizeof(buf), "%s of keys [%d, %d], no statistics", how, low, high);
+		plan = buf;
+		return true;
+	}
+	
+	//Fraction of the keys in [low, high]
+	double selectivity = 0;
+	if(tree.getEntryCount() > 0 && low <= tree.getMaxKey() && high >= tree.getMinKey()){
+		double lo = max(low, tree.getMinKey());
+		double hi = min(high, tree.getMaxKey());
+		selectivity = (hi - lo + 1) / ((double)tree.getMaxKey() - tree.getMinKey() + 1);
+	}
+	double rows = selectivity * tree.getEntryCount();
+	
+	//A scan reads the pages that the zone map of the table does not rule out
+	double pages = rf.endRid().pid + (rf.endRid().sid > 0 ? 1 : 0);
+	double scanCost = rf.countPages(low, high);
+	
+	//Descend the tree and read the leaves of the range, or descend once per bound
+	//of the range and of each key excluded by NE to count it.
+	//The resident upper levels of the tree cost no page read
+	int descent = tree.getTreeHeight() - tree.getResidentLevels();
+	double indexCost = descent - 1 + ceil(selectivity * tree.getLeafCount());
+	if(counted){
+		int descents = 2 + 2 * pred.excluded.size();
+		indexCost = descents * descent;
+	}
+	//Large ranges are fetched in RecordId order, so each table page holding one of
+	//the tuples is read once. Of pages pages, about pages * (1 - (1 - 1/pages)^rows)
+	//hold one of rows tuples. Small ranges read a page per tuple
+	if(fetch && pages > 0){
+		if(rows > SORT_FETCH_MIN_ENTRIES)
+			indexCost += pages * (1 - pow(1 - 1/pages, rows));
+		else
+			indexCost += rows;
+	}
+	
+	if(indexCost <= scanCost){
+		snprintf(buf, sizeof(buf), "%s of keys [%d, %d], est. %.0f rows, cost %.0f (table scan %.0f)",
+			how, low, high, rows, indexCost, scanCost);
+		plan = buf;
+		return true;
+	}
+	snprintf(buf, sizeof(buf), "table scan, cost %.0f (%s of keys [%d, %d], est. %.0f rows, cost %.0f)",
+		scanCost, how, low, high, rows, indexCost);
+	plan = buf;
+	return false;
 }
 
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
@@ -90,13 +528,17 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 	
   RC     rc;
   int    key;     
-  string value;
+	const char* value;  //the value of the tuple, located in its pinned table page
+	int    length;
+	RecordPage page = { -1, NULL };
 	int    count;
-	int    diff;
+	
+	//The conditions are parsed once, not for every tuple
+	Predicate pred(cond);
 	
   BTreeIndex tree;
   bool index = false;
-	bool ignoreValue = false;
+	bool indexOnly;
 	
 	//Open the table file
 	if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
@@ -104,8 +546,18 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 		return rc;
 	}
 	
-	//Only need index if have a comparison on key, not including notequal
-	for(int i = 0; i < cond.size(); i++){
+	//SELECT key and count(*) with conditions on the key only are answered
+	//from the index leaves, without reading the table
+	indexOnly = (attr == 1 || attr == 4);
+	for(size_t i = 0; i < cond.size(); i++){
+		if(cond[i].attr == 2)
+			indexOnly = false;
+	}
+	
+	//Only need index if have a comparison on key, not including notequal,
+	//or if the index alone answers the query
+	index = indexOnly;
+	for(size_t i = 0; i < cond.size(); i++){
 		if(cond[i].attr == 1 && cond[i].comp != SelCond::NE){
 			index = true;
 			break;
@@ -117,66 +569,107 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 		index = false;
   }
 
-	//optimize ignore read if count is asked for
-	if(attr == 4){
-		ignoreValue = true;
+	//Use the index only if it is estimated to be cheaper than the scan
+	lastPlan = "table scan";
+	if(index && !chooseIndex(tree, rf, pred, attr, indexOnly, lastPlan)){
+		tree.close();
+		index = false;
 	}
+
   
 	//Start index and count in the beginning
 	rid.pid = rid.sid = 0;
 	count = 0;	
 	
   if(index){
-		int low, high;
-		IndexCursor cursor;
-		bool status;
-		if(conditionRange(cond, low, high)){
+		int low = pred.low, high = pred.high;
+		IndexIterator cursor(tree);
+		//A chunk of the index range, and the entries and tuples read at a time
+		vector<RecordId> rids;
+		int keys[BATCH_ENTRIES];
+		RecordId batch[BATCH_ENTRIES];
+		int n;
+		bool pastHigh = false;
+		//The key range comes from the compiled conditions, so it covers every int key
+		if(low <= high){
+			//Index probes and the tuple fetches they cause jump around the files
+			tree.advise(PageFile::RANDOM);
+			rf.advise(PageFile::RANDOM);
+			//The index yields only keys of [low, high], which the key conditions allow
+			pred.checkRange = false;
+			//count(*) of the range comes from the tree, less the keys excluded by NE,
+			//each value once
+			if(attr == 4 && indexOnly){
+				vector<int> excluded;
+				if((rc = tree.countRange(low, high, count)) < 0)
+					goto exit_tree_select;
+				for(size_t i = 0; i < pred.excluded.size(); i++){
+					int num = pred.excluded[i];
+					if(num < low || num > high)
+						continue;
+					if(find(excluded.begin(), excluded.end(), num) != excluded.end())
+						continue;
+					excluded.push_back(num);
+					if((rc = tree.countRange(num, num, n)) < 0)
+						goto exit_tree_select;
+					count -= n;
+				}
+				fprintf(stdout, "%d\n", count);
+				rc = 0;
+				goto exit_tree_select;
+			}
+			
 			//Traverse values in the given range and print them out in the B+Tree
 			if((rc = tree.locate(low, cursor)) < 0)
 				goto exit_tree_select;
-			while((rc = tree.readForward(cursor, key, rid)) >= 0 && key <= high){		
-				// read the tuple
-				if (ignoreValue){
-					count++;
-					continue;
-				}else{
-					if ((rc = rf.read(rid, key, value)) < 0) {
-						fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-						goto exit_tree_select;
+			while(!pastHigh){
+				//Collect the next chunk of the range from the index, a few entries
+				//at a time so that the index is not read far past high
+				rids.clear();
+				while((int)rids.size() < RID_SORT_ENTRIES && !pastHigh){
+					if((rc = tree.readForward(cursor, keys, batch, BATCH_ENTRIES, n)) < 0){
+						if(rc != RC_END_OF_TREE)
+							goto exit_tree_select;
+						pastHigh = true;
+						break;
 					}
-					for(int i = 0; i < cond.size(); i++){
-						switch(cond[i].attr){
-							case 1:
-								diff = key - atoi(cond[i].value);
-								break;
-							case 2:
-								diff = strcmp(value.c_str(), cond[i].value);
-								break;
+					for(int b = 0; b < n; b++){
+						if(keys[b] > high){
+							pastHigh = true;
+							break;
 						}
-
-						// skip the tuple if any condition is not met
-						switch (cond[i].comp){
-							case SelCond::EQ:
-								if (diff != 0) goto next_tree_tuple;
-								break;
-							case SelCond::NE:
-								if (diff == 0) goto next_tree_tuple;
-								break;
-							case SelCond::GT:
-								if (diff <= 0) goto next_tree_tuple;
-								break;
-							case SelCond::LT:
-								if (diff >= 0) goto next_tree_tuple;
-								break;
-							case SelCond::GE:
-								if (diff < 0) goto next_tree_tuple;
-								break;
-							case SelCond::LE:
-								if (diff > 0) goto next_tree_tuple;
-								break;
+						if(!indexOnly){
+							rids.push_back(batch[b]);
+							continue;
 						}
+						//The leaf entry holds all the query needs
+						if(!pred.keyMatches(keys[b]))
+							continue;
+						count++;
+						if(attr == 1)
+							fprintf(stdout, "%d\n", keys[b]);
+					}
+				}
+				int m = rids.size();
+				if(m == 0)
+					continue;
+				
+				//A large range visits many table pages. Fetch the tuples in RecordId
+				//order, so each table page is pinned once for all its tuples.
+				//A small range is fetched in key order
+				if(m > SORT_FETCH_MIN_ENTRIES)
+					sort(rids.begin(), rids.end());
+				
+				for(int f = 0; f < m; f++){
+					//The value is read in place, in the page kept pinned for the next tuples
+					if ((rc = rf.read(rids[f], key, value, length, page)) < 0) {
+						fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+						goto exit_tree_select;
 					}
 				
+					// skip the tuple if any condition is not met
+					if (!pred.matches(key, value, length)) continue;
+				
 					// the condition is met for the tuple. 
 					// increase matching tuple counter
 					count++;
@@ -186,16 +679,12 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 							fprintf(stdout, "%d\n", key);
 							break;
 						case 2:  // SELECT value
-							fprintf(stdout, "%s\n", value.c_str());
+							fprintf(stdout, "%.*s\n", length, value);
 							break;
 						case 3:  // SELECT *
-							fprintf(stdout, "%d '%s'\n", key, value.c_str());
+							fprintf(stdout, "%d '%.*s'\n", key, length, value);
 							break;
 						}		
-				
-					//Skip to next tuple
-					next_tree_tuple:
-					continue;
 				}
 			}
 			
@@ -215,50 +704,59 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 		}
 
 		exit_tree_select:
+		rf.release(page);
+		cursor.close();
 		tree.close();
 		return rc;
   }else{
+		//The table is read front to back. the page layer reads ahead
+		rf.advise(PageFile::SEQUENTIAL);
+		
+		//Pages whose keys are all outside the key range of the conditions are skipped.
+		//Conflicting conditions rule out every page
+		int pages = rf.endRid().pid + (rf.endRid().sid > 0 ? 1 : 0);
+		int skipped = pages - rf.countPages(pred.low, pred.high);
+		if(skipped > 0){
+			char buf[64];
+			snprintf(buf, sizeof(buf), ", zone map skips %d of %d pages", skipped, pages);
+			lastPlan += buf;
+		}
+		
+		//A table of several morsels is split among the scan threads
+		int threads = scanThreads > 0 ? scanThreads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+		int morsels = (pages + MORSEL_PAGES - 1) / MORSEL_PAGES;
+		if(threads > morsels)
+			threads = morsels;
+		//A batch scan reads the morsels in the calling thread too
+		if(threads > 1 || scanBatches){
+			char buf[64];
+			if(scanBatches)
+				lastPlan += ", batches";
+			if(threads > 1){
+				snprintf(buf, sizeof(buf), ", %d threads", threads);
+				lastPlan += buf;
+			}
+			if((rc = parallelScan(rf, pred, attr, threads, scanOrdered, scanBatches, count)) < 0){
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				goto exit_select;
+			}
+			rid = rf.endRid();
+		}
+		
 		while (rid < rf.endRid()) {
-			// read the tuple
-			if ((rc = rf.read(rid, key, value)) < 0) {
+			if (rid.sid == 0 && !rf.mayHoldKeys(rid.pid, pred.low, pred.high)) {
+				rid.pid++;
+				continue;
+			}
+
+			// read the tuple. its page stays pinned for the next tuples
+			if ((rc = rf.read(rid, key, value, length, page)) < 0) {
 				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
 				goto exit_select;
 			}
 
       // check the conditions on the tuple
-			for (unsigned i = 0; i < cond.size(); i++) {
-				// compute the difference between the tuple value and the condition value
-				switch (cond[i].attr) {
-					case 1:
-						diff = key - atoi(cond[i].value);
-						break;
-					case 2:
-						diff = strcmp(value.c_str(), cond[i].value);
-						break;
-				}
-
-				// skip the tuple if any condition is not met
-				switch (cond[i].comp) {
-					case SelCond::EQ:
-						if (diff != 0) goto next_tuple;
-							break;
-					case SelCond::NE:
-						if (diff == 0) goto next_tuple;
-							break;
-					case SelCond::GT:
-						if (diff <= 0) goto next_tuple;
-							break;
-					case SelCond::LT:
-						if (diff >= 0) goto next_tuple;
-							break;
-					case SelCond::GE:
-						if (diff < 0) goto next_tuple;
-							break;
-					case SelCond::LE:
-						if (diff > 0) goto next_tuple;
-							break;
-				}
-			}
+			if (!pred.matches(key, value, length)) goto next_tuple;
 	
 			// the condition is met for the tuple. 
 			// increase matching tuple counter
@@ -270,16 +768,16 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 				fprintf(stdout, "%d\n", key);
 				break;
 			case 2:  // SELECT value
-				fprintf(stdout, "%s\n", value.c_str());
+				fprintf(stdout, "%.*s\n", length, value);
 				break;
 			case 3:  // SELECT *
-				fprintf(stdout, "%d '%s'\n", key, value.c_str());
+				fprintf(stdout, "%d '%.*s'\n", key, length, value);
 				break;
 			}
 
 			// move to the next tuple
 			next_tuple:
-			++rid;
+			rf.advance(rid);
 		}
 
 		// print matching tuple count if "select count(*)"
@@ -290,6 +788,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
 		// close the table file and return
 		exit_select:
+		rf.release(page);
 		rf.close();
 		return rc;
 	}
@@ -298,9 +797,9 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 {
 	RecordFile rf;
-	RecordId rid;
 	RC rc;
 	BTreeIndex tree;
+	IndexSorter entries;
 	ifstream file(loadfile.c_str());
 	
 	//open the table file and loadfile and BTreeIndex
@@ -322,38 +821,58 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 		}
 	}
 	
-	//Read in tuples
+	//Read in tuples a batch at a time
+	int keys[BATCH_ENTRIES];
+	string values[BATCH_ENTRIES];
+	RecordId rids[BATCH_ENTRIES];
 	while(!file.eof()){
-		int key;
-		string line, value;
-		getline(file, line);
+		int n = 0;
+		while(n < BATCH_ENTRIES && !file.eof()){
+			string line;
+			getline(file, line);
+			
+			//Skip lines that cannot be parsed, such as the empty last line
+			if((rc = parseLoadLine(line, keys[n], values[n])) < 0)
+				continue;
+			
+			//Ignore empty lines
+			if(keys[n] != 0 || values[n] != "")
+				n++;
+		}
 		
-		if((rc = parseLoadLine(line, key, value)) < 0){
+		//Write to table, a page at a time
+		if((rc = rf.appendBatch(keys, values, n, rids)) < 0){
+			fprintf(stderr, "Error: Error writing to table %s\n", table.c_str());
 			rf.close();
 			file.close();
-			if(index)
-				tree.close();
+			tree.close();
+			return rc;
 		}
-		
-		//Ignore empty lines
-		if(key != 0 || strcmp(value.c_str(), "") != 0){
-			//Write to table
-			rf.append(key, value, rid);
-			//Write to tree
-			if(index){
-				if((rc = tree.insert(key, rid)) < 0){
-					rf.close();
-					file.close();
-					tree.close();
-					return rc;
-				}
-			}			
+		//Collect the index entries, the tree is built from them at the end
+		for(int i = 0; index && i < n; i++){
+			if((rc = entries.add(keys[i], rids[i])) < 0){
+				rf.close();
+				file.close();
+				tree.close();
+				return rc;
+			}
 		}
 	}
-	rf.close();
+	if((rc = rf.close()) < 0){
+		fprintf(stderr, "Error: Error writing to table %s\n", table.c_str());
+		file.close();
+		tree.close();
+		return rc;
+	}
 	file.close();
-	if(index)
-		tree.close();	
+	if(index){
+		//An empty index is built bottom-up from the sorted entries
+		if((rc = tree.bulkLoad(entries)) < 0){
+			tree.close();
+			return rc;
+		}
+		tree.close();
+	}
   return 0;
 }
 
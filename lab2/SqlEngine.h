@@ -50,6 +50,40 @@ class SqlEngine {
    */
   static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds);
 
+  /**
+   * describe the plan of the last select() of the calling thread: an index scan
+   * or a table scan, with the estimated cost of both in page reads when the
+   * index could be used.
+   * @return the description of the plan
+   */
+  static const std::string& getLastPlan();
+
+  /**
+   * set the # threads a table scan is split among. each thread reads
+   * runs of table pages and checks the conditions on their tuples.
+   * a small table is scanned by fewer threads.
+   * @param n[IN] the # threads. 0 for one per processor
+   * @return error code. 0 if no error
+   */
+  static RC setScanThreads(int n);
+  static int getScanThreads() { return scanThreads; }
+
+  /**
+   * choose whether a table scan with several threads prints the tuples
+   * in table order (the default) or in the order the threads find them.
+   * @param on[IN] true to print the tuples in table order
+   */
+  static void setScanOrdered(bool on) { scanOrdered = on; }
+
+  /**
+   * choose how a table scan checks the conditions: on batches of the
+   * tuples of several pages at a time (the default), comparing the keys
+   * with vector instructions and copying only the values of the matching
+   * tuples, or a tuple at a time.
+   * @param on[IN] true to scan in batches
+   */
+  static void setScanBatches(bool on) { scanBatches = on; }
+
   /**
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
@@ -67,6 +101,12 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+ private:
+  static thread_local std::string lastPlan;  // the plan of the last select() of the thread
+  static int  scanThreads;       // # threads of a table scan (0: one per processor)
+  static bool scanOrdered;       // a parallel scan prints the tuples in table order
+  static bool scanBatches;       // a table scan checks the conditions a batch at a time
 };
 
 #endif /* SQLENGINE_H */
@@ -17,14 +17,20 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   struct tms tmsbuf;
   clock_t btime, etime;
   int     bpagecnt, epagecnt;
+  int     bhitcnt, ehitcnt, bmisscnt, emisscnt;
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
+  bhitcnt = PageFile::getCacheHitCount();
+  bmisscnt = PageFile::getCacheMissCount();
   SqlEngine::select(attr, table, conds);
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
+  ehitcnt = PageFile::getCacheHitCount();
+  emisscnt = PageFile::getCacheMissCount();
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages. Plan: %s\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt, SqlEngine::getLastPlan().c_str());
+  fprintf(stderr, "  -- cache: %d hits, %d misses (%s)\n", ehitcnt - bhitcnt, emisscnt - bmisscnt, BufferPool::policyName(PageFile::getReplacementPolicy()));
 }
 
 %}
@@ -7,11 +7,118 @@
  * @date 3/24/2008
  */
  
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
+#include "BTreeIndex.h"
+#include "RecordFile.h"
 
-int main()
+static void usage(const char* prog)
 {
+  fprintf(stderr, "usage: %s [-p pages | -m MB] [-a pages] [-s bytes] [-f pct] [-i KB] [-r policy] [-l format] [-e mode] [-t n] [-u] [-W] [-M]\n", prog);
+  fprintf(stderr, "  -p pages  size of the page cache in pages\n");
+  fprintf(stderr, "  -m MB     size of the page cache in megabytes. a cached page takes as\n");
+  fprintf(stderr, "            much memory as the largest page in use (-s, or a file opened\n");
+  fprintf(stderr, "            with larger pages), so small pages fit more pages in MB\n");
+  fprintf(stderr, "  -a pages  read-ahead window for sequential reads (0 = off)\n");
+  fprintf(stderr, "  -s bytes  page size of new files (1024 to 16384)\n");
+  fprintf(stderr, "  -f pct    fill percentage of the nodes of an index built by LOAD\n");
+  fprintf(stderr, "  -i KB     memory of each open index for its upper nodes (0 = none)\n");
+  fprintf(stderr, "  -r policy page replacement policy: lru (default), clock or 2q\n");
+  fprintf(stderr, "  -l format record format of new tables: slotted (default) or fixed\n");
+  fprintf(stderr, "  -e mode   table scan executor: batch (default) or tuple\n");
+  fprintf(stderr, "  -t n      # threads of a table scan (0 = one per processor)\n");
+  fprintf(stderr, "  -u        let a table scan with several threads print tuples out of order\n");
+  fprintf(stderr, "  -W        write pages through to the disk immediately\n");
+  fprintf(stderr, "  -M        memory-map files opened for reading\n");
+}
+
+static RC setPolicy(const char* name)
+{
+  for (int p = 0; p < BufferPool::POLICY_COUNT; p++) {
+    if (strcmp(name, BufferPool::policyName((BufferPool::Policy) p)) == 0) {
+      return PageFile::setReplacementPolicy((BufferPool::Policy) p);
+    }
+  }
+  return RC_INVALID_POLICY;
+}
+
+static RC setExecutor(const char* name)
+{
+  if (strcmp(name, "batch") == 0) SqlEngine::setScanBatches(true);
+  else if (strcmp(name, "tuple") == 0) SqlEngine::setScanBatches(false);
+  else return RC_INVALID_ATTRIBUTE;
+  return 0;
+}
+
+static RC setFormat(const char* name)
+{
+  if (strcmp(name, "slotted") == 0) return RecordFile::setDefaultFormat(RecordFile::FORMAT_SLOTTED);
+  if (strcmp(name, "fixed") == 0) return RecordFile::setDefaultFormat(RecordFile::FORMAT_FIXED);
+  return RC_INVALID_FILE_FORMAT;
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  RC  rc = 0;
+
+  // process the command-line options
+  while ((c = getopt(argc, argv, "p:m:a:s:f:i:r:l:e:t:uWM")) != -1) {
+    switch (c) {
+    case 'p':
+      rc = PageFile::setCacheSize(atoi(optarg));
+      break;
+    case 'm':
+      rc = PageFile::setCacheSizeMB(atoi(optarg));
+      break;
+    case 'a':
+      rc = PageFile::setReadAhead(atoi(optarg));
+      break;
+    case 's':
+      rc = PageFile::setDefaultPageSize(atoi(optarg));
+      break;
+    case 'f':
+      rc = BTreeIndex::setFillFactor(atoi(optarg));
+      break;
+    case 'i':
+      rc = BTreeIndex::setResidentMemory(atoi(optarg) * 1024);
+      break;
+    case 'r':
+      rc = setPolicy(optarg);
+      break;
+    case 'l':
+      rc = setFormat(optarg);
+      break;
+    case 'e':
+      rc = setExecutor(optarg);
+      break;
+    case 't':
+      rc = SqlEngine::setScanThreads(atoi(optarg));
+      break;
+    case 'u':
+      SqlEngine::setScanOrdered(false);
+      break;
+    case 'W':
+      rc = PageFile::setWriteBack(false);
+      break;
+    case 'M':
+      PageFile::setMemoryMapped(true);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+    if (rc < 0) {
+      fprintf(stderr, "Error: invalid argument for option -%c\n", c);
+      return 1;
+    }
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 